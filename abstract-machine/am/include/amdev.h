@@ -31,6 +31,9 @@ AM_DEVREG(21, NET_CONFIG,   RD, bool present);
 AM_DEVREG(22, NET_STATUS,   RD, int rx_len, tx_len);
 AM_DEVREG(23, NET_TX,       WR, Area buf);
 AM_DEVREG(24, NET_RX,       WR, Area buf);
+AM_DEVREG(25, GPU_FILL,     WR, int x, y, w, h; uint32_t color);
+AM_DEVREG(26, GPU_COPY,     WR, int x, y, w, h; int src_x, src_y);
+AM_DEVREG(27, GPU_BLIT,     WR, int x, y; void *pixels; int w, h; bool blend);
 
 // Input
 
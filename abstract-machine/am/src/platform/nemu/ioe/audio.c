@@ -8,19 +8,47 @@
 #define AUDIO_INIT_ADDR      (AUDIO_ADDR + 0x10)
 #define AUDIO_COUNT_ADDR     (AUDIO_ADDR + 0x14)
 
+static uint32_t sbuf_size = 0;
+static uint32_t sbuf_pos = 0;
+
 void __am_audio_init() {
+  sbuf_size = inl(AUDIO_SBUF_SIZE_ADDR);
 }
 
 void __am_audio_config(AM_AUDIO_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->present = true;
+  cfg->bufsize = sbuf_size;
 }
 
 void __am_audio_ctrl(AM_AUDIO_CTRL_T *ctrl) {
+  outl(AUDIO_FREQ_ADDR, ctrl->freq);
+  outl(AUDIO_CHANNELS_ADDR, ctrl->channels);
+  outl(AUDIO_SAMPLES_ADDR, ctrl->samples);
+  outl(AUDIO_INIT_ADDR, 1);
+  sbuf_pos = 0;
 }
 
 void __am_audio_status(AM_AUDIO_STATUS_T *stat) {
-  stat->count = 0;
+  stat->count = inl(AUDIO_COUNT_ADDR);
 }
 
 void __am_audio_play(AM_AUDIO_PLAY_T *ctl) {
+  uint8_t *buf = ctl->buf.start;
+  uint32_t len = ctl->buf.end - ctl->buf.start;
+  volatile uint8_t *sbuf = (volatile uint8_t *)AUDIO_SBUF_ADDR;
+  while (len > 0) {
+    // wait for some free space in the stream buffer, and fill it
+    uint32_t space;
+    while ((space = sbuf_size - inl(AUDIO_COUNT_ADDR)) == 0) ;
+    uint32_t n = (len < space ? len : space);
+    for (uint32_t i = 0; i < n; i ++) {
+      sbuf[sbuf_pos] = buf[i];
+      sbuf_pos = (sbuf_pos + 1 == sbuf_size ? 0 : sbuf_pos + 1);
+    }
+
+    // the device takes the bytes appended since the last read of the count
+    outl(AUDIO_COUNT_ADDR, inl(AUDIO_COUNT_ADDR) + n);
+    buf += n;
+    len -= n;
+  }
 }
@@ -3,12 +3,25 @@
 
 #define SYNC_ADDR (VGACTL_ADDR + 4)
 
+// 2D acceleration, see src/device/vga.c in NEMU
+#define ACCEL_CMD_ADDR   (VGACTL_ADDR + 0x08)
+#define ACCEL_X_ADDR     (VGACTL_ADDR + 0x0c)
+#define ACCEL_Y_ADDR     (VGACTL_ADDR + 0x10)
+#define ACCEL_W_ADDR     (VGACTL_ADDR + 0x14)
+#define ACCEL_H_ADDR     (VGACTL_ADDR + 0x18)
+#define ACCEL_SRCX_ADDR  (VGACTL_ADDR + 0x1c)
+#define ACCEL_SRCY_ADDR  (VGACTL_ADDR + 0x20)
+#define ACCEL_SRC_ADDR   (VGACTL_ADDR + 0x24)
+#define ACCEL_COLOR_ADDR (VGACTL_ADDR + 0x28)
+
+enum { ACCEL_FILL = 1, ACCEL_COPY, ACCEL_BLIT, ACCEL_BLEND };
+
 void __am_gpu_init() {
 }
 
 void __am_gpu_config(AM_GPU_CONFIG_T *cfg) {
   *cfg = (AM_GPU_CONFIG_T) {
-    .present = true, .has_accel = false,
+    .present = true, .has_accel = true,
     .width = 0, .height = 0,
     .vmemsz = 0
   };
@@ -23,3 +36,31 @@ void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
 void __am_gpu_status(AM_GPU_STATUS_T *status) {
   status->ready = true;
 }
+
+static void accel_rect(int x, int y, int w, int h) {
+  outl(ACCEL_X_ADDR, x);
+  outl(ACCEL_Y_ADDR, y);
+  outl(ACCEL_W_ADDR, w);
+  outl(ACCEL_H_ADDR, h);
+}
+
+void __am_gpu_fill(AM_GPU_FILL_T *ctl) {
+  accel_rect(ctl->x, ctl->y, ctl->w, ctl->h);
+  outl(ACCEL_COLOR_ADDR, ctl->color);
+  outl(ACCEL_CMD_ADDR, ACCEL_FILL);
+}
+
+void __am_gpu_copy(AM_GPU_COPY_T *ctl) {
+  accel_rect(ctl->x, ctl->y, ctl->w, ctl->h);
+  outl(ACCEL_SRCX_ADDR, ctl->src_x);
+  outl(ACCEL_SRCY_ADDR, ctl->src_y);
+  outl(ACCEL_CMD_ADDR, ACCEL_COPY);
+}
+
+void __am_gpu_blit(AM_GPU_BLIT_T *ctl) {
+  accel_rect(ctl->x, ctl->y, ctl->w, ctl->h);
+  outl(ACCEL_SRCX_ADDR, 0);
+  outl(ACCEL_SRCY_ADDR, 0);
+  outl(ACCEL_SRC_ADDR, (uintptr_t)ctl->pixels);
+  outl(ACCEL_CMD_ADDR, ctl->blend ? ACCEL_BLEND : ACCEL_BLIT);
+}
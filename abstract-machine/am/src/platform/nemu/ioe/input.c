@@ -3,7 +3,23 @@
 
 #define KEYDOWN_MASK 0x8000
 
+#define KBD_DATA_ADDR    (KBD_ADDR + 0x00)
+#define KBD_COUNT_ADDR   (KBD_ADDR + 0x04)
+#define KBD_BATCH_ADDR   (KBD_ADDR + 0x10)
+
+// keys popped by one read of the count register, served one by one
+static uint32_t batch[32];
+static int nr_batch = 0, batch_idx = 0;
+
 void __am_input_keybrd(AM_INPUT_KEYBRD_T *kbd) {
-  kbd->keydown = 0;
-  kbd->keycode = AM_KEY_NONE;
+  if (batch_idx == nr_batch) {
+    nr_batch = inl(KBD_COUNT_ADDR);
+    for (batch_idx = 0; batch_idx < nr_batch; batch_idx ++) {
+      batch[batch_idx] = inl(KBD_BATCH_ADDR + batch_idx * 4);
+    }
+    batch_idx = 0;
+  }
+  uint32_t k = (batch_idx < nr_batch ? batch[batch_idx ++] : AM_KEY_NONE);
+  kbd->keydown = (k & KEYDOWN_MASK) != 0;
+  kbd->keycode = k & ~KEYDOWN_MASK;
 }
@@ -10,6 +10,9 @@ void __am_timer_uptime(AM_TIMER_UPTIME_T *);
 void __am_gpu_config(AM_GPU_CONFIG_T *);
 void __am_gpu_status(AM_GPU_STATUS_T *);
 void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *);
+void __am_gpu_fill(AM_GPU_FILL_T *);
+void __am_gpu_copy(AM_GPU_COPY_T *);
+void __am_gpu_blit(AM_GPU_BLIT_T *);
 void __am_audio_config(AM_AUDIO_CONFIG_T *);
 void __am_audio_ctrl(AM_AUDIO_CTRL_T *);
 void __am_audio_status(AM_AUDIO_STATUS_T *);
@@ -33,6 +36,9 @@ static void *lut[128] = {
   [AM_GPU_CONFIG  ] = __am_gpu_config,
   [AM_GPU_FBDRAW  ] = __am_gpu_fbdraw,
   [AM_GPU_STATUS  ] = __am_gpu_status,
+  [AM_GPU_FILL    ] = __am_gpu_fill,
+  [AM_GPU_COPY    ] = __am_gpu_copy,
+  [AM_GPU_BLIT    ] = __am_gpu_blit,
   [AM_UART_CONFIG ] = __am_uart_config,
   [AM_AUDIO_CONFIG] = __am_audio_config,
   [AM_AUDIO_CTRL  ] = __am_audio_ctrl,
@@ -19,18 +19,34 @@
 #include <common.h>
 #include <difftest-def.h>
 
+#ifdef CONFIG_COMMIT_LOG
+// record the execution to a commit log, or compare it with one, see commit-log.c
+void commit_log_step(vaddr_t pc, uint32_t inst);
+void commit_log_store(paddr_t addr, int len, word_t data);
+void commit_log_skip();
+void commit_log_sync();
+#endif
+
 #ifdef CONFIG_DIFFTEST
 void difftest_skip_ref();
 void difftest_skip_dut(int nr_ref, int nr_dut);
 void difftest_set_patch(void (*fn)(void *arg), void *arg);
 void difftest_step(vaddr_t pc, vaddr_t npc);
+// compare the instructions which are not compared yet
+void difftest_flush();
+// wait for REF to compare all the instructions executed
+void difftest_sync();
+void difftest_log_store(paddr_t addr, int len);
 void difftest_detach();
 void difftest_attach();
 #else
-static inline void difftest_skip_ref() {}
+static inline void difftest_skip_ref() { IFDEF(CONFIG_COMMIT_LOG, commit_log_skip()); }
 static inline void difftest_skip_dut(int nr_ref, int nr_dut) {}
 static inline void difftest_set_patch(void (*fn)(void *arg), void *arg) {}
 static inline void difftest_step(vaddr_t pc, vaddr_t npc) {}
+static inline void difftest_flush() {}
+static inline void difftest_sync() {}
+static inline void difftest_log_store(paddr_t addr, int len) {}
 static inline void difftest_detach() {}
 static inline void difftest_attach() {}
 #endif
@@ -16,9 +16,24 @@
 #ifndef __DEVICE_ALARM_H__
 #define __DEVICE_ALARM_H__
 
+#include <common.h>
+
 #define TIMER_HZ 60
 
 typedef void (*alarm_handler_t) ();
-void add_alarm_handle(alarm_handler_t h);
+// call `h` once `fd` becomes readable, and then wait for alarm_rearm_fd()
+int add_alarm_fd(int fd, alarm_handler_t h);
+void alarm_rearm_fd(int id);
+// watch `fd` instead, and the old one must not be closed yet
+void alarm_change_fd(int id, int fd);
+
+// wake up the CPU loop after `us` microseconds, used for host events
+void alarm_set_timeout(uint64_t us);
+void alarm_cancel_timeout();
+
+// call the handlers of expired alarms on the emulation thread,
+// and return whether the timeout has expired
+bool alarm_dispatch();
+bool alarm_pending();
 
 #endif
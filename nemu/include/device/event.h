@@ -0,0 +1,38 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_EVENT_H__
+#define __DEVICE_EVENT_H__
+
+#include <common.h>
+
+// Deadlines of an event are measured in guest instructions (EVENT_GUEST)
+// or in host microseconds since boot (EVENT_HOST, see get_time()).
+enum { EVENT_GUEST, EVENT_HOST, NR_EVENT_CLOCK };
+
+typedef void (*event_handler_t) ();
+
+// the CPU loop calls event_run() once `g_nr_guest_inst` reaches this value
+extern uint64_t g_next_event;
+
+int  event_register(const char *name, int clock, event_handler_t h);
+bool event_valid(int id);
+// `when` is an absolute deadline, and the event is one-shot if `period` is 0
+void event_schedule(int id, uint64_t when, uint64_t period);
+void event_cancel(int id);
+uint64_t event_now(int clock);
+void event_run();
+
+#endif
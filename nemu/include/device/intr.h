@@ -0,0 +1,28 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_INTR_H__
+#define __DEVICE_INTR_H__
+
+#include <common.h>
+
+// interrupt lines of the interrupt controller, and line 0 means no interrupt
+#define NR_IRQ 32
+
+void dev_raise_intr();
+// drive the level of an interrupt line of the interrupt controller
+void dev_set_irq(int irq, bool level);
+
+#endif
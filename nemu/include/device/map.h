@@ -19,6 +19,8 @@
 #include <cpu/difftest.h>
 
 typedef void(*io_callback_t)(uint32_t, int, bool);
+// a bulk callback moves the data itself, and the map has no space
+typedef void(*io_bulk_callback_t)(void *opaque, uint32_t offset, void *buf, uint32_t len, bool is_write);
 uint8_t* new_space(int size);
 
 typedef struct {
@@ -28,6 +30,8 @@ typedef struct {
   paddr_t high;
   void *space;
   io_callback_t callback;
+  io_bulk_callback_t bulk;
+  void *opaque;
 } IOMap;
 
 static inline bool map_inside(IOMap *map, paddr_t addr) {
@@ -49,6 +53,10 @@ void add_pio_map(const char *name, ioaddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
 void add_mmio_map(const char *name, paddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
+void add_mmio_map_bulk(const char *name, paddr_t addr, uint32_t len,
+        io_bulk_callback_t bulk, void *opaque);
+// for plugins, which should get an error instead of an assertion failure
+bool mmio_map_full();
 
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
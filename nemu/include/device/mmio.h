@@ -20,5 +20,8 @@
 
 word_t mmio_read(paddr_t addr, int len);
 void mmio_write(paddr_t addr, int len, word_t data);
+// access [addr, addr + len) of one map, with one call to a bulk callback,
+// return false if the range is not inside one map
+bool mmio_bulk_access(paddr_t addr, void *buf, uint32_t len, bool is_write);
 
 #endif
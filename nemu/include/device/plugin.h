@@ -0,0 +1,68 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_PLUGIN_H__
+#define __DEVICE_PLUGIN_H__
+
+// ABI of device plugins loaded with `--plugin=PATH[,ARGS]`.
+// This header is self-contained, so that plugins can be built out of tree:
+//   gcc -shared -fPIC -I$NEMU_HOME/include/device -o dev.so dev.c
+// A plugin exports nemu_plugin_init(), which is called once after the
+// built-in devices are initialized. A plugin only calls NEMU through the
+// function table it is given, and every call is made on the emulation thread.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NEMU_PLUGIN_VERSION 1
+
+// Copy `len` bytes between `buf` and the device at `offset` of the range.
+// Accesses of the CPU are at most 8 bytes, while bus masters (e.g. the
+// `dma_*` functions below) can access a whole range in one call.
+typedef void (*nemu_mmio_fn)(void *opaque, uint32_t offset, void *buf, uint32_t len, bool is_write);
+
+enum { NEMU_CLOCK_GUEST, NEMU_CLOCK_HOST }; // the same as EVENT_GUEST and EVENT_HOST
+
+typedef struct {
+  uint32_t version;
+
+  // map [addr, addr + len) to the device, return 0 on success
+  int (*add_mmio)(const char *name, uint64_t addr, uint32_t len, nemu_mmio_fn fn, void *opaque);
+
+  // deadlines are in guest instructions or host microseconds, see device/event.h;
+  // event_register() returns the id of the event, or -1 on error,
+  // and the other two return -1 if `id` is not registered
+  int (*event_register)(const char *name, int clock, void (*handler)());
+  int (*event_schedule)(int id, uint64_t when, uint64_t period);
+  int (*event_cancel)(int id);
+  uint64_t (*event_now)(int clock);
+
+  // drive the level of an interrupt line of the interrupt controller,
+  // return -1 if `irq` is not in [1, 32)
+  int (*set_irq)(int irq, bool level);
+
+  // access the physical address space as a bus master, return 0 on success,
+  // or -1 if the range is not inside the memory or inside one MMIO range
+  int (*dma_read)(uint64_t addr, void *buf, uint32_t len);
+  int (*dma_write)(uint64_t addr, const void *buf, uint32_t len);
+
+  void (*log)(const char *fmt, ...);
+} NEMUPluginAPI;
+
+// return 0 on success, `args` is an empty string if not given
+typedef int (*nemu_plugin_init_fn)(const NEMUPluginAPI *api, const char *args);
+#define NEMU_PLUGIN_INIT "nemu_plugin_init"
+
+#endif
@@ -17,6 +17,7 @@
 #define __DIFFTEST_DEF_H__
 
 #include <stdint.h>
+#include <string.h>
 #include <macro.h>
 #include <generated/autoconf.h>
 
@@ -37,4 +38,35 @@ enum { DIFFTEST_TO_DUT, DIFFTEST_TO_REF };
 # error Unsupport ISA
 #endif
 
+// The hash of memory compared by the DUT with difftest_memhash() of REF, in
+// the style of xxHash64. The four lanes are independent, so that they are
+// computed in parallel by the host CPU.
+static inline uint64_t difftest_hash(const void *buf, size_t n) {
+  const uint64_t P1 = 0x9e3779b185ebca87ull, P2 = 0xc2b2ae3d27d4eb4full, P3 = 0x165667b19e3779f9ull;
+  const uint8_t *p = (const uint8_t *)buf;
+  uint64_t v[4] = { P1 + P2, P2, 0, 0 - P1 };
+  uint64_t x, h = n;
+  size_t i;
+  int j;
+  for (i = 0; i + 32 <= n; i += 32) {
+    for (j = 0; j < 4; j ++) {
+      memcpy(&x, p + i + j * 8, 8);
+      v[j] += x * P2;
+      v[j] = ((v[j] << 31) | (v[j] >> 33)) * P1;
+    }
+  }
+  for (j = 0; j < 4; j ++) {
+    h += (v[j] << (j * 6 + 1)) | (v[j] >> (63 - j * 6));
+    h = (h ^ (v[j] * P2)) * P1;
+  }
+  for (; i < n; i ++) {
+    h = (h ^ (p[i] * P3)) * P1;
+    h = (h << 11) | (h >> 53);
+  }
+  h ^= h >> 33; h *= P2;
+  h ^= h >> 29; h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
 #endif
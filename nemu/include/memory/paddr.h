@@ -34,4 +34,8 @@ static inline bool in_pmem(paddr_t addr) {
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
+// share pmem copy-on-write with NEMU as REF, see init_difftest()
+bool pmem_share(void (*share)(paddr_t addr, int fd, size_t n));
+void pmem_map_private(int fd);
+
 #endif
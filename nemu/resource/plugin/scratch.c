@@ -0,0 +1,50 @@
+// An example device plugin of NEMU: a scratch memory with a doorbell.
+//
+//   gcc -O2 -shared -fPIC -I$NEMU_HOME/include/device -o scratch.so scratch.c
+//   nemu --plugin=scratch.so,0xa8000000,4096,3 IMAGE
+//
+// The arguments are the base address, the size of the memory and the
+// interrupt source in PLIC. The last word of the memory is the doorbell.
+// Writing a number of guest instructions N to it raises the interrupt
+// N instructions later, and writing 0 to it clears the interrupt.
+
+#include <plugin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const NEMUPluginAPI *nemu = NULL;
+static uint8_t *mem = NULL;
+static uint32_t size = 0;
+static int irq = 0;
+static int event = -1;
+
+static void ring() {
+  nemu->set_irq(irq, true);
+}
+
+static void scratch_access(void *opaque, uint32_t offset, void *buf, uint32_t len, bool is_write) {
+  if (!is_write) { memcpy(buf, mem + offset, len); return; }
+  memcpy(mem + offset, buf, len);
+  uint32_t bell = size - 4;
+  if (offset <= bell && offset + len > bell) {
+    uint32_t delay;
+    memcpy(&delay, mem + bell, 4);
+    nemu->set_irq(irq, false);
+    if (delay == 0) nemu->event_cancel(event);
+    else nemu->event_schedule(event, nemu->event_now(NEMU_CLOCK_GUEST) + delay, 0);
+  }
+}
+
+int nemu_plugin_init(const NEMUPluginAPI *api, const char *args) {
+  unsigned long long base = 0;
+  if (api->version != NEMU_PLUGIN_VERSION) return -1;
+  if (sscanf(args, "%llx,%u,%d", &base, &size, &irq) != 3 || size < 4) return -2;
+  nemu = api;
+  mem = calloc(1, size);
+  if (mem == NULL) return -3;
+  event = api->event_register("scratch", NEMU_CLOCK_GUEST, ring);
+  if (event < 0) return -4;
+  api->log("scratch: %u bytes at 0x%llx, irq %d", size, base, irq);
+  return api->add_mmio("scratch", base, size, scratch_access, NULL);
+}
@@ -55,6 +55,9 @@
 #define SDHBCT 0x3c /* Host byte count (debug)         - 32 R/W */
 #define SDDATA 0x40 /* Data to/from SD card            - 32 R/W */
 #define SDHBLC 0x50 /* Host block count (SDIO/SDHC)    -  9 R/W */
+/* NEMU-specific, only available with CONFIG_SDCARD_DMA in NEMU */
+#define SDDMAADDR 0x54 /* Physical address of DMA buffer - 32 R/W */
+#define SDDMACNT  0x58 /* Blocks to transfer by DMA      - 32 R/W */
 
 #define SDCMD_NEW_FLAG			0x8000
 #define SDCMD_FAIL_FLAG			0x4000
@@ -89,12 +92,14 @@ struct nemu_host {
 	unsigned int		max_clk;	/* Max possible freq */
 	struct sg_mapping_iter	sg_miter;	/* SG state for PIO */
 	unsigned int		blocks;		/* remaining PIO blocks */
+	int			sg_count;	/* Mapped sg entries for DMA */
 
 	struct mmc_request	*mrq;		/* Current request */
 	struct mmc_command	*cmd;		/* Current command */
 	struct mmc_data		*data;		/* Current data request */
 	bool			data_complete:1;/* Data finished before cmd */
 	bool			use_sbc:1;	/* Send CMD23 */
+	bool			use_dma:1;	/* "nemu,dma" in dts */
 };
 
 static void nemu_reset(struct mmc_host *mmc)
@@ -102,6 +107,7 @@ static void nemu_reset(struct mmc_host *mmc)
 }
 
 static void nemu_finish_command(struct nemu_host *host);
+static void nemu_finish_data(struct nemu_host *host);
 
 static void nemu_transfer_block_pio(struct nemu_host *host, bool is_read)
 {
@@ -190,6 +196,24 @@ void nemu_prepare_data(struct nemu_host *host, struct mmc_command *cmd)
 	host->data_complete = false;
 	host->data->bytes_xfered = 0;
 
+	if (host->use_dma) {
+		/* The whole request is transferred by NEMU in a single copy when
+		 * the command is written. max_segs is 1, so the request is
+		 * always physically contiguous.
+		 */
+		host->sg_count = dma_map_sg(&host->pdev->dev, data->sg, data->sg_len,
+					    mmc_get_dma_dir(data));
+		if (host->sg_count == 1) {
+			writel(sg_dma_address(data->sg), host->ioaddr + SDDMAADDR);
+			writel(data->blocks, host->ioaddr + SDDMACNT);
+			return;
+		}
+		if (host->sg_count > 0)
+			dma_unmap_sg(&host->pdev->dev, data->sg, data->sg_len,
+				     mmc_get_dma_dir(data));
+		host->sg_count = 0;
+	}
+
   /* Use PIO */
   if (data->flags & MMC_DATA_READ)
     flags |= SG_MITER_TO_SG;
@@ -199,6 +223,25 @@ void nemu_prepare_data(struct nemu_host *host, struct mmc_command *cmd)
   host->blocks = data->blocks;
 }
 
+static void nemu_transfer_data(struct nemu_host *host)
+{
+	int i;
+
+	if (host->sg_count) {
+		/* Done by NEMU when the command was sent */
+		dma_unmap_sg(&host->pdev->dev, host->data->sg, host->data->sg_len,
+			     mmc_get_dma_dir(host->data));
+		host->sg_count = 0;
+	} else {
+		// start PIO right now
+		for (i = 0; i < host->data->blocks; i ++) {
+			nemu_transfer_pio(host);
+		}
+	}
+
+	nemu_finish_data(host);
+}
+
 static void nemu_finish_request(struct nemu_host *host)
 {
 	struct mmc_request *mrq;
@@ -316,12 +359,7 @@ static void nemu_finish_command(struct nemu_host *host)
 		host->cmd = NULL;
 		if (nemu_send_command(host, host->mrq->cmd)) {
 			if (host->data) {
-        // start PIO right now
-        for (i = 0; i < host->data->blocks; i ++) {
-          nemu_transfer_pio(host);
-        }
-
-        nemu_finish_data(host);
+        nemu_transfer_data(host);
       }
 
       nemu_finish_command(host);
@@ -380,12 +418,7 @@ static void nemu_request(struct mmc_host *mmc, struct mmc_request *mrq)
 		}
 	} else if (mrq->cmd && nemu_send_command(host, mrq->cmd)) {
 		if (host->data) {
-      int i;
-      // start PIO right now
-      for (i = 0; i < host->data->blocks; i ++) {
-        nemu_transfer_pio(host);
-      }
-      nemu_finish_data(host);
+      nemu_transfer_data(host);
     }
 
     nemu_finish_command(host);
@@ -427,7 +460,8 @@ static int nemu_add_host(struct nemu_host *host)
 	spin_lock_init(&host->lock);
 	mutex_init(&host->mutex);
 
-	mmc->max_segs = 128;
+	/* NEMU copies a DMA request in one go, so it must be contiguous */
+	mmc->max_segs = host->use_dma ? 1 : 128;
 	mmc->max_req_size = 524288;
 	mmc->max_seg_size = mmc->max_req_size;
 	mmc->max_blk_size = 1024;
@@ -441,7 +475,7 @@ static int nemu_add_host(struct nemu_host *host)
 		return ret;
 	}
 
-	dev_info(dev, "loaded - DMA %s\n", "disabled");
+	dev_info(dev, "loaded - DMA %s\n", host->use_dma ? "enabled" : "disabled");
 
 	return 0;
 }
@@ -487,6 +521,12 @@ static int nemu_probe(struct platform_device *pdev)
 
 	host->max_clk = 1000000; //clk_get_rate(clk);
 
+	host->use_dma = of_property_read_bool(pdev->dev.of_node, "nemu,dma");
+	if (host->use_dma && dma_set_mask_and_coherent(dev, DMA_BIT_MASK(32))) {
+		dev_warn(dev, "32-bit DMA not supported, use PIO\n");
+		host->use_dma = false;
+	}
+
 	ret = mmc_of_parse(mmc);
 	if (ret)
 		goto err;
@@ -16,6 +16,7 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <device/event.h>
 #include <locale.h>
 #include <stdbool.h>
 #include "../../src/monitor/sdb/sdb.h"
@@ -32,14 +33,13 @@ uint64_t g_nr_guest_inst = 0;
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
-void device_update();
-
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 #ifdef CONFIG_ITRACE_COND
   if (ITRACE_COND) { log_write("%s\n", _this->logbuf); }
 #endif
   if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
   IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
+  IFDEF(CONFIG_COMMIT_LOG, commit_log_step(_this->pc, _this->isa.inst.val));
   #ifdef CONFIG_WATCHPOINT
     // 扫描所有监视点
     bool flag = false;
@@ -88,7 +88,21 @@ static void execute(uint64_t n) {
     g_nr_guest_inst ++;
     trace_and_difftest(&s, cpu.pc);
     if (nemu_state.state != NEMU_RUNNING) break;
-    IFDEF(CONFIG_DEVICE, device_update());
+#ifdef CONFIG_DEVICE
+    if (g_nr_guest_inst >= __atomic_load_n(&g_next_event, __ATOMIC_RELAXED)) {
+      // events may change the memory of REF by DMA
+      difftest_flush();
+      if (nemu_state.state != NEMU_RUNNING) break;
+      event_run();
+    }
+    word_t intr = isa_query_intr();
+    if (intr != INTR_EMPTY) {
+      difftest_flush();
+      if (nemu_state.state != NEMU_RUNNING) break;
+      cpu.pc = isa_raise_intr(intr, cpu.pc);
+      IFDEF(CONFIG_DIFFTEST, ref_difftest_raise_intr(intr));
+    }
+#endif
   }
 }
 
@@ -119,6 +133,8 @@ void cpu_exec(uint64_t n) {
   uint64_t timer_start = get_time();
 
   execute(n);
+  difftest_sync();
+  IFDEF(CONFIG_COMMIT_LOG, commit_log_sync());
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
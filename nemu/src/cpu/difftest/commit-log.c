@@ -0,0 +1,244 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/difftest.h>
+#include <difftest-def.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef CONFIG_COMMIT_LOG
+
+// A commit log is recorded once from a trusted run (e.g. with difftest
+// against REF) by `--record`, and later runs are compared with it by
+// `--verify` without REF. The log is a header, the initial state, and a
+// record for each instruction:
+//   uint32_t inst;
+//   uint8_t  nr_reg;   // LOG_SKIP is set if difftest skips the instruction
+//   uint8_t  nr_store;
+//   { uint8_t idx; word_t val; }               [nr_reg]    registers written
+//   { paddr_t addr; uint8_t len; word_t data; } [nr_store] stores to pmem
+// The registers are the words of the first DIFFTEST_REG_SIZE bytes of
+// CPU_state, the part compared by difftest. The registers written by an
+// interrupt are recorded with the next instruction. Fields are packed in
+// the byte order of the host.
+// Like difftest, the state of a skipped instruction (e.g. reading a timer)
+// is taken from the DUT instead of being compared.
+
+#define LOG_MAGIC "NEMUCLOG"
+#define LOG_VERSION 1
+#define LOG_SKIP 0x80
+#define NR_LOG_REG ((int)(DIFFTEST_REG_SIZE / sizeof(word_t)))
+#define MAX_STORE 16
+#define REG_ENTRY_SIZE (1 + sizeof(word_t))
+#define STORE_ENTRY_SIZE (sizeof(paddr_t) + 1 + sizeof(word_t))
+#define MAX_RECORD_SIZE (6 + NR_LOG_REG * REG_ENTRY_SIZE + MAX_STORE * STORE_ENTRY_SIZE)
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint16_t word_size;
+  uint16_t paddr_size;
+  uint32_t reg_size;
+  uint32_t pad;
+} LogHeader;
+
+typedef struct {
+  paddr_t addr;
+  int len;
+  word_t data;
+} LogStore;
+
+enum { LOG_OFF, LOG_RECORD, LOG_VERIFY };
+
+static int mode = LOG_OFF;
+static FILE *record_fp = NULL;
+static const uint8_t *log_p = NULL, *log_end = NULL;
+// the state after the last record, it is the state of the log when verifying
+static CPU_state state = {};
+static LogStore store[MAX_STORE];
+static int nr_store = 0;
+static bool skip = false;
+static uint64_t nr_record = 0;
+
+void commit_log_skip() {
+  skip = true;
+}
+
+void commit_log_store(paddr_t addr, int len, word_t data) {
+  if (mode == LOG_OFF) return;
+  Assert(nr_store < MAX_STORE, "Too many stores by the instruction at pc = " FMT_WORD, cpu.pc);
+  if (len < (int)sizeof(word_t)) data &= ((word_t)1 << (len * 8)) - 1;
+  store[nr_store ++] = (LogStore) { .addr = addr, .len = len, .data = data };
+}
+
+static void record(uint32_t inst) {
+  static_assert(NR_LOG_REG < LOG_SKIP, "too many registers for a record");
+  uint8_t buf[MAX_RECORD_SIZE];
+  uint8_t *p = buf + 6;
+  word_t *now = (word_t *)&cpu, *last = (word_t *)&state;
+  int i, nr_reg = 0;
+  for (i = 0; i < NR_LOG_REG; i ++) {
+    if (now[i] == last[i]) continue;
+    last[i] = now[i];
+    *p ++ = i;
+    memcpy(p, &now[i], sizeof(word_t)); p += sizeof(word_t);
+    nr_reg ++;
+  }
+  for (i = 0; i < nr_store; i ++) {
+    memcpy(p, &store[i].addr, sizeof(paddr_t)); p += sizeof(paddr_t);
+    *p ++ = store[i].len;
+    memcpy(p, &store[i].data, sizeof(word_t)); p += sizeof(word_t);
+  }
+  memcpy(buf, &inst, 4);
+  buf[4] = nr_reg | (skip ? LOG_SKIP : 0);
+  buf[5] = nr_store;
+  size_t ret = fwrite(buf, p - buf, 1, record_fp);
+  Assert(ret == 1, "Can not write the commit log: %s", strerror(errno));
+}
+
+static void mismatch(vaddr_t pc) {
+  Log("Mismatch with record #%" PRIu64 " of the commit log", nr_record);
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = pc;
+  isa_reg_display();
+}
+
+static void verify(vaddr_t pc, uint32_t inst) {
+  if (log_p == log_end) {
+    Log("The commit log ends, but the DUT executes the instruction at pc = " FMT_WORD, pc);
+    mismatch(pc);
+    return;
+  }
+  const uint8_t *p = log_p;
+  uint32_t log_inst;
+  memcpy(&log_inst, p, 4);
+  bool log_skip = (p[4] & LOG_SKIP) != 0;
+  int nr_reg = p[4] & ~LOG_SKIP;
+  int log_nr_store = p[5];
+  size_t size = 6 + nr_reg * REG_ENTRY_SIZE + log_nr_store * STORE_ENTRY_SIZE;
+  Assert(nr_reg <= NR_LOG_REG && size <= (size_t)(log_end - p),
+      "The commit log is broken at record #%" PRIu64, nr_record);
+  log_p += size;
+  p += 6;
+
+  word_t *last = (word_t *)&state;
+  int i;
+  for (i = 0; i < nr_reg; i ++, p += REG_ENTRY_SIZE) {
+    Assert(p[0] < NR_LOG_REG, "The commit log is broken at record #%" PRIu64, nr_record);
+    memcpy(&last[p[0]], p + 1, sizeof(word_t));
+  }
+
+  bool ok = true;
+  if (log_inst != inst) {
+    Log("The instruction at pc = " FMT_WORD " is different, right = 0x%08x, wrong = 0x%08x",
+        pc, log_inst, inst);
+    ok = false;
+  }
+  if (log_nr_store != nr_store) {
+    Log("The instruction at pc = " FMT_WORD " stores %d times, but %d times in the log",
+        pc, nr_store, log_nr_store);
+    ok = false;
+  }
+  for (i = 0; i < log_nr_store && i < nr_store; i ++, p += STORE_ENTRY_SIZE) {
+    LogStore s = { .addr = 0, .len = p[sizeof(paddr_t)], .data = 0 };
+    memcpy(&s.addr, p, sizeof(paddr_t));
+    memcpy(&s.data, p + sizeof(paddr_t) + 1, sizeof(word_t));
+    if (s.addr != store[i].addr || s.len != store[i].len || s.data != store[i].data) {
+      Log("Store #%d of the instruction at pc = " FMT_WORD " is different, right = %d bytes of "
+          FMT_WORD " to " FMT_PADDR ", wrong = %d bytes of " FMT_WORD " to " FMT_PADDR, i, pc,
+          s.len, s.data, s.addr, store[i].len, store[i].data, store[i].addr);
+      ok = false;
+    }
+  }
+
+  if (log_skip) memcpy(&state, &cpu, DIFFTEST_REG_SIZE);
+  else if (memcmp(&state, &cpu, DIFFTEST_REG_SIZE) != 0) {
+    isa_difftest_checkregs(&state, pc);
+    ok = false;
+  }
+  if (!ok) mismatch(pc);
+}
+
+void commit_log_step(vaddr_t pc, uint32_t inst) {
+  if (mode == LOG_OFF) return;
+  if (mode == LOG_RECORD) record(inst);
+  else verify(pc, inst);
+  nr_record ++;
+  nr_store = 0;
+  skip = false;
+}
+
+void commit_log_sync() {
+  if (mode == LOG_RECORD) fflush(record_fp);
+  else if (mode == LOG_VERIFY && nemu_state.state == NEMU_END && log_p != log_end) {
+    Log("The DUT stops after %" PRIu64 " instructions, but the commit log has more", nr_record);
+    nemu_state.state = NEMU_ABORT;
+  }
+}
+
+static void open_log(const char *file) {
+  int fd = open(file, O_RDONLY);
+  Assert(fd >= 0, "Can not open the commit log '%s': %s", file, strerror(errno));
+  struct stat st;
+  Assert(fstat(fd, &st) == 0, "Can not get the size of '%s'", file);
+  size_t size = st.st_size;
+  Assert(size >= sizeof(LogHeader) + DIFFTEST_REG_SIZE, "'%s' is not a commit log", file);
+  // the records are only read once and in order
+  const uint8_t *p = (const uint8_t *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  Assert(p != MAP_FAILED, "Can not map '%s': %s", file, strerror(errno));
+  madvise((void *)p, size, MADV_SEQUENTIAL);
+  close(fd);
+
+  LogHeader hdr;
+  memcpy(&hdr, p, sizeof(hdr));
+  Assert(memcmp(hdr.magic, LOG_MAGIC, sizeof(hdr.magic)) == 0 && hdr.version == LOG_VERSION,
+      "'%s' is not a commit log of this version", file);
+  Assert(hdr.word_size == sizeof(word_t) && hdr.paddr_size == sizeof(paddr_t) &&
+      hdr.reg_size == DIFFTEST_REG_SIZE, "'%s' is recorded by NEMU of another ISA", file);
+  memcpy(&state, p + sizeof(hdr), DIFFTEST_REG_SIZE);
+  if (memcmp(&state, &cpu, DIFFTEST_REG_SIZE) != 0) {
+    isa_difftest_checkregs(&state, cpu.pc);
+    panic("The initial state is different from the commit log");
+  }
+  log_p = p + sizeof(hdr) + DIFFTEST_REG_SIZE;
+  log_end = p + size;
+  Log("Verify the execution with the commit log '%s' of %zu bytes", file, size);
+}
+
+static void create_log(const char *file) {
+  record_fp = fopen(file, "wb");
+  Assert(record_fp, "Can not create the commit log '%s': %s", file, strerror(errno));
+  setvbuf(record_fp, NULL, _IOFBF, 1 << 20);
+  LogHeader hdr = { .magic = {}, .version = LOG_VERSION, .word_size = sizeof(word_t),
+    .paddr_size = sizeof(paddr_t), .reg_size = DIFFTEST_REG_SIZE, .pad = 0 };
+  memcpy(hdr.magic, LOG_MAGIC, sizeof(hdr.magic));
+  memcpy(&state, &cpu, DIFFTEST_REG_SIZE);
+  fwrite(&hdr, sizeof(hdr), 1, record_fp);
+  fwrite(&state, DIFFTEST_REG_SIZE, 1, record_fp);
+  Log("Record the execution to the commit log '%s'", file);
+}
+
+void init_commit_log(const char *record_file, const char *verify_file) {
+  Assert(record_file == NULL || verify_file == NULL, "Can not record and verify a commit log at the same time");
+  if (record_file != NULL) { create_log(record_file); mode = LOG_RECORD; }
+  if (verify_file != NULL) { open_log(verify_file); mode = LOG_VERIFY; }
+}
+
+#endif
@@ -17,23 +17,73 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/difftest.h>
+#include <memory/host.h>
 #include <memory/paddr.h>
 #include <utils.h>
 #include <difftest-def.h>
 
-void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) = NULL;
+// devices send their writes to REF without checking whether there is one
+static void ref_nop_memcpy(paddr_t addr, void *buf, size_t n, bool direction) { }
+static void ref_nop_raise_intr(uint64_t NO) { }
+
+void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) = ref_nop_memcpy;
 void (*ref_difftest_regcpy)(void *dut, bool direction) = NULL;
 void (*ref_difftest_exec)(uint64_t n) = NULL;
-void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
+void (*ref_difftest_raise_intr)(uint64_t NO) = ref_nop_raise_intr;
 
 #ifdef CONFIG_DIFFTEST
 
+// optional, see ref_exec_window()
+static void (*ref_difftest_exec_until)(uint64_t n, uint64_t pc) = NULL;
+static void (*ref_difftest_exec_block)(uint64_t n, uint64_t pc) = NULL;
+// optional, see ref_sync_skip()
+static void (*ref_difftest_regcpy_mask)(void *dut, uint64_t mask) = NULL;
+
+// The REF executes a window of up to WINDOW instructions with one call,
+// and only the state at the end of the window is compared. The state of
+// the DUT after each instruction in the window is kept in `ring`, and the
+// old data of each store is kept in `undo`. On a mismatch, the REF is rolled
+// back to the start of the window and replays it one instruction at a time
+// against `ring` to find the first diverging instruction.
+// A window is closed early before anything which changes the REF from the
+// outside: a skipped instruction (e.g. MMIO), an interrupt, and events
+// which may write guest memory by DMA.
+
+// REF on its own thread compares every instruction, see pipeline.c
+#define WINDOW MUXDEF(CONFIG_DIFFTEST_PIPELINE, 1, CONFIG_DIFFTEST_WINDOW)
+
+typedef struct {
+  paddr_t addr;
+  int len;
+  word_t data;
+} StoreUndo;
+
+// not set if init_difftest() is not called, e.g. when a commit log is verified
+static bool is_on = false;
 static bool is_skip_ref = false;
 static int skip_dut_nr_inst = 0;
 
+static CPU_state win_start = {};
+static CPU_state ring[WINDOW];
+static vaddr_t ring_pc[WINDOW];
+static int nr_pending = 0;
+static StoreUndo *undo = NULL;
+static int nr_undo = 0, max_undo = 0;
+
+static void window_flush();
+static void ref_update();
+void init_difftest_pipeline();
+void difftest_pipe_step(vaddr_t pc);
+bool difftest_pipe_sync();
+
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
 void difftest_skip_ref() {
+  IFDEF(CONFIG_COMMIT_LOG, commit_log_skip());
+  if (!is_on) return;
+  // the REF should first catch up with the state before this instruction
+  window_flush();
   is_skip_ref = true;
   // If such an instruction is one of the instruction packing in QEMU
   // (see below), we end the process of catching up with QEMU's pc to
@@ -52,6 +102,9 @@ void difftest_skip_ref() {
 //   Let REF run `nr_ref` instructions first.
 //   We expect that DUT will catch up with REF within `nr_dut` instructions.
 void difftest_skip_dut(int nr_ref, int nr_dut) {
+  if (!is_on) return;
+  window_flush();
+  ref_update();
   skip_dut_nr_inst += nr_dut;
 
   while (nr_ref -- > 0) {
@@ -59,6 +112,158 @@ void difftest_skip_dut(int nr_ref, int nr_dut) {
   }
 }
 
+// Skipped instructions are not sent to REF one by one. The state after
+// the last one of them is sent before REF executes again, so consecutive
+// skipped instructions (e.g. polling a device) are synchronized once. REF
+// has the state `win_start`, and only the words different from it are sent
+// if REF exports difftest_regcpy_mask().
+// Similarly, the memory written by devices is kept in `batch` until REF
+// executes again, and adjacent writes are sent at once.
+
+#define NR_REG_WORD ((int)(DIFFTEST_REG_SIZE / sizeof(word_t)))
+#define BATCH_SIZE (64 * 1024)
+
+static void (*real_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) = NULL;
+static void (*real_raise_intr)(uint64_t NO) = NULL;
+static bool ref_stale = false;
+static CPU_state skip_state = {};
+static uint8_t batch[BATCH_SIZE];
+static paddr_t batch_addr = 0;
+static size_t batch_len = 0;
+
+static void batch_flush() {
+  if (batch_len == 0) return;
+  real_memcpy(batch_addr, batch, batch_len, DIFFTEST_TO_REF);
+  batch_len = 0;
+}
+
+static void batch_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
+  if (direction == DIFFTEST_TO_REF && n <= BATCH_SIZE) {
+    if (batch_len > 0 && (addr != batch_addr + batch_len || batch_len + n > BATCH_SIZE)) batch_flush();
+    if (batch_len == 0) batch_addr = addr;
+    memcpy(batch + batch_len, buf, n);
+    batch_len += n;
+    return;
+  }
+  batch_flush();
+  real_memcpy(addr, buf, n, direction);
+}
+
+static void ref_sync_skip() {
+  if (!ref_stale) return;
+  ref_stale = false;
+  if (ref_difftest_regcpy_mask != NULL) {
+    static_assert(NR_REG_WORD <= 64, "too many registers for the mask");
+    word_t *now = (word_t *)&skip_state, *old = (word_t *)&win_start;
+    uint64_t mask = 0;
+    int i;
+    for (i = 0; i < NR_REG_WORD; i ++) {
+      if (now[i] != old[i]) mask |= 1ull << i;
+    }
+    if (mask != 0) ref_difftest_regcpy_mask(&skip_state, mask);
+  } else {
+    ref_difftest_regcpy(&skip_state, DIFFTEST_TO_REF);
+  }
+  win_start = skip_state;
+}
+
+// send to REF what it has not received, before it executes or is read
+static void ref_update() {
+  batch_flush();
+  ref_sync_skip();
+}
+
+static void sync_raise_intr(uint64_t NO) {
+  ref_update();
+  real_raise_intr(NO);
+  // the window starts after the interrupt
+  win_start = cpu;
+}
+
+#ifdef CONFIG_DIFFTEST_MEMCHECK
+// Every CONFIG_DIFFTEST_MEMCHECK_INTERVAL instructions, the pages written by
+// the DUT since the last check are compared with REF. REF hashes its pages
+// with difftest_memhash() if it exports one, and only the pages with
+// different hashes are copied from REF and compared byte by byte.
+// A store of REF to a page which the DUT does not write is not found here,
+// but the old data of the page in the DUT is usually loaded later.
+
+#define MEMCHECK_PAGE_SHIFT 12
+#define MEMCHECK_PAGE_SIZE (1u << MEMCHECK_PAGE_SHIFT)
+#define NR_MEMCHECK_PAGE (CONFIG_MSIZE >> MEMCHECK_PAGE_SHIFT)
+
+static uint64_t (*ref_difftest_memhash)(paddr_t addr, size_t n) = NULL;
+static uint64_t dirty[(NR_MEMCHECK_PAGE + 63) / 64] = {};
+static uint64_t memcheck_count = 0;
+static vaddr_t memcheck_pc = 0; // pc of the first instruction after the last check
+
+static inline void mark_dirty(paddr_t addr) {
+  uint32_t idx = (addr - CONFIG_MBASE) >> MEMCHECK_PAGE_SHIFT;
+  dirty[idx / 64] |= 1ull << (idx % 64);
+}
+
+// return false if the page is different
+static bool memcheck_page(paddr_t addr) {
+  uint8_t *dut = guest_to_host(addr);
+  if (ref_difftest_memhash != NULL &&
+      ref_difftest_memhash(addr, MEMCHECK_PAGE_SIZE) == difftest_hash(dut, MEMCHECK_PAGE_SIZE)) return true;
+  static uint8_t ref[MEMCHECK_PAGE_SIZE];
+  ref_difftest_memcpy(addr, ref, MEMCHECK_PAGE_SIZE, DIFFTEST_TO_DUT);
+  if (memcmp(ref, dut, MEMCHECK_PAGE_SIZE) == 0) return true;
+  uint32_t i, first = MEMCHECK_PAGE_SIZE, nr_diff = 0;
+  for (i = 0; i < MEMCHECK_PAGE_SIZE; i ++) {
+    if (ref[i] == dut[i]) continue;
+    if (nr_diff ++ == 0) first = i;
+  }
+  Log("Memory is different at " FMT_PADDR ", right = 0x%02x, wrong = 0x%02x, "
+      "%u different bytes in the page", addr + first, ref[first], dut[first], nr_diff);
+  return false;
+}
+
+// compare the dirty pages, REF should have executed the same instructions
+static void memcheck(vaddr_t pc) {
+  bool ok = true;
+  uint32_t w;
+  for (w = 0; w < ARRLEN(dirty); w ++) {
+    while (dirty[w] != 0) {
+      int bit = __builtin_ctzll(dirty[w]);
+      dirty[w] &= dirty[w] - 1;
+      paddr_t addr = CONFIG_MBASE + (((paddr_t)w * 64 + bit) << MEMCHECK_PAGE_SHIFT);
+      if (!memcheck_page(addr)) ok = false;
+    }
+  }
+  if (!ok) {
+    Log("The wrong store is executed by one of the %" PRIu64 " instructions from pc = "
+        FMT_WORD " to pc = " FMT_WORD, memcheck_count, memcheck_pc, pc);
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = pc;
+  }
+  memcheck_count = 0;
+  memcheck_pc = cpu.pc;
+}
+
+static void memcheck_step(vaddr_t pc) {
+  if (++ memcheck_count < CONFIG_DIFFTEST_MEMCHECK_INTERVAL) return;
+  // let REF catch up with the DUT
+  window_flush();
+  ref_update();
+  if (!MUXDEF(CONFIG_DIFFTEST_PIPELINE, difftest_pipe_sync(), true)) return;
+  if (nemu_state.state != NEMU_ABORT) memcheck(pc);
+}
+#endif
+
+void difftest_log_store(paddr_t addr, int len) {
+  if (!is_on) return;
+  IFDEF(CONFIG_DIFFTEST_MEMCHECK, mark_dirty(addr); mark_dirty(addr + len - 1));
+  if (WINDOW == 1) return;
+  if (nr_undo == max_undo) {
+    max_undo = (max_undo == 0 ? 1024 : max_undo * 2);
+    undo = (StoreUndo *)realloc(undo, sizeof(StoreUndo) * max_undo);
+    assert(undo);
+  }
+  undo[nr_undo ++] = (StoreUndo) { .addr = addr, .len = len, .data = host_read(guest_to_host(addr), len) };
+}
+
 void init_difftest(char *ref_so_file, long img_size, int port) {
   assert(ref_so_file != NULL);
 
@@ -78,6 +283,13 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   ref_difftest_raise_intr = dlsym(handle, "difftest_raise_intr");
   assert(ref_difftest_raise_intr);
 
+  ref_difftest_exec_until = dlsym(handle, "difftest_exec_until");
+  ref_difftest_exec_block = dlsym(handle, "difftest_exec_block");
+  // REF on its own thread only receives the whole state
+  IFNDEF(CONFIG_DIFFTEST_PIPELINE, ref_difftest_regcpy_mask = dlsym(handle, "difftest_regcpy_mask"));
+  void (*ref_difftest_memshare)(paddr_t, int, size_t) = dlsym(handle, "difftest_memshare");
+  IFDEF(CONFIG_DIFFTEST_MEMCHECK, ref_difftest_memhash = dlsym(handle, "difftest_memhash"));
+
   void (*ref_difftest_init)(int) = dlsym(handle, "difftest_init");
   assert(ref_difftest_init);
 
@@ -87,8 +299,22 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
       "If it is not necessary, you can turn it off in menuconfig.", ref_so_file);
 
   ref_difftest_init(port);
-  ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
+  // both map the whole pmem copy-on-write, instead of copying the image
+  if (ref_difftest_memshare == NULL || !pmem_share(ref_difftest_memshare)) {
+    ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
+  }
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  win_start = cpu;
+  if (WINDOW > 1) Log("Compare with REF every %d instructions", WINDOW);
+  IFDEF(CONFIG_DIFFTEST_MEMCHECK, memcheck_pc = cpu.pc;
+      Log("Compare the written memory with REF every %d instructions, %s", CONFIG_DIFFTEST_MEMCHECK_INTERVAL,
+        (ref_difftest_memhash ? "by hashes" : "by copying from REF")));
+  IFDEF(CONFIG_DIFFTEST_PIPELINE, init_difftest_pipeline());
+  real_memcpy = ref_difftest_memcpy;
+  ref_difftest_memcpy = batch_memcpy;
+  real_raise_intr = ref_difftest_raise_intr;
+  ref_difftest_raise_intr = sync_raise_intr;
+  is_on = true;
 }
 
 static void checkregs(CPU_state *ref, vaddr_t pc) {
@@ -99,14 +325,106 @@ static void checkregs(CPU_state *ref, vaddr_t pc) {
   }
 }
 
+// compare `ref` with the DUT state `dut`, which is not necessarily `cpu`
+static bool check_state(CPU_state *ref, CPU_state *dut, vaddr_t pc, bool report) {
+  CPU_state saved = cpu;
+  cpu = *dut;
+  bool ok = isa_difftest_checkregs(ref, pc);
+  if (!ok && report) {
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = pc;
+    isa_reg_display();
+  }
+  cpu = saved;
+  return ok;
+}
+
+static void window_bisect() {
+  Log("Mismatch in the window of %d instructions starting at pc = " FMT_WORD
+      ", replaying it on REF", nr_pending, win_start.pc);
+  // roll back the REF: stores are undone in reverse order
+  int i;
+  for (i = nr_undo - 1; i >= 0; i --) {
+    real_memcpy(undo[i].addr, &undo[i].data, undo[i].len, DIFFTEST_TO_REF);
+  }
+  ref_difftest_regcpy(&win_start, DIFFTEST_TO_REF);
+  // stores to addresses which only the REF wrote can not be undone
+  for (i = 0; i < nr_pending; i ++) {
+    CPU_state ref_r;
+    ref_difftest_exec(1);
+    ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+    if (!check_state(&ref_r, &ring[i], ring_pc[i], true)) {
+      Log("The first diverging instruction is #%d of the window at pc = " FMT_WORD, i, ring_pc[i]);
+      return;
+    }
+  }
+  Log("Can not reproduce the mismatch by replaying, the REF may be nondeterministic");
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = ring_pc[nr_pending - 1];
+}
+
+// If the pc at the end of the window is not reached earlier in the window,
+// the REF can run to it (e.g. by a breakpoint) instead of counting instructions.
+// If the window is also a straight-line block, i.e. the pcs are increasing,
+// the code of the window is exactly the bytes between its first pc and the end.
+static void ref_exec_window() {
+  vaddr_t end = ring[nr_pending - 1].pc;
+  bool until = ((ref_difftest_exec_until != NULL || ref_difftest_exec_block != NULL) && nr_pending > 1);
+  bool block = until;
+  int i;
+  for (i = 0; until && i < nr_pending; i ++) {
+    until = (ring_pc[i] != end);
+    // the state after an instruction has the pc of the next one
+    block = block && (ring_pc[i] < ring[i].pc);
+  }
+  if (block && ref_difftest_exec_block != NULL) ref_difftest_exec_block(nr_pending, end);
+  else if (until && ref_difftest_exec_until != NULL) ref_difftest_exec_until(nr_pending, end);
+  else ref_difftest_exec(nr_pending);
+}
+
+// let the REF execute the pending instructions, and compare the states
+static void window_flush() {
+  if (nr_pending == 0) return;
+  CPU_state ref_r;
+  ref_exec_window();
+  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  CPU_state *dut = &ring[nr_pending - 1];
+  // a window of one instruction is the same as comparing every instruction
+  bool single = (nr_pending == 1);
+  if (!check_state(&ref_r, dut, ring_pc[nr_pending - 1], single) && !single) window_bisect();
+  win_start = *dut;
+  nr_pending = 0;
+  nr_undo = 0;
+}
+
+void difftest_flush() {
+  if (!is_on) return;
+  window_flush();
+  ref_update();
+}
+
+void difftest_sync() {
+  if (!is_on) return;
+  window_flush();
+  ref_update();
+  IFDEF(CONFIG_DIFFTEST_PIPELINE, difftest_pipe_sync());
+#ifdef CONFIG_DIFFTEST_MEMCHECK
+  // also check the stores before the execution stops
+  if (nemu_state.state != NEMU_ABORT) memcheck(cpu.pc);
+#endif
+}
+
 void difftest_step(vaddr_t pc, vaddr_t npc) {
   CPU_state ref_r;
 
+  if (!is_on) return;
+
   if (skip_dut_nr_inst > 0) {
     ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
     if (ref_r.pc == npc) {
       skip_dut_nr_inst = 0;
       checkregs(&ref_r, npc);
+      win_start = cpu;
       return;
     }
     skip_dut_nr_inst --;
@@ -116,16 +434,26 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
   }
 
   if (is_skip_ref) {
-    // to skip the checking of an instruction, just copy the reg state to reference design
-    ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+    // to skip the checking of an instruction, the reg state is copied to
+    // reference design before it executes again, see ref_sync_skip()
+    skip_state = cpu;
+    ref_stale = true;
     is_skip_ref = false;
+    nr_undo = 0;
     return;
   }
 
-  ref_difftest_exec(1);
-  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  ref_update();
 
-  checkregs(&ref_r, pc);
+#ifdef CONFIG_DIFFTEST_PIPELINE
+  difftest_pipe_step(pc);
+#else
+  ring[nr_pending] = cpu;
+  ring_pc[nr_pending] = pc;
+  nr_pending ++;
+  if (nr_pending == WINDOW) window_flush();
+#endif
+  IFDEF(CONFIG_DIFFTEST_MEMCHECK, memcheck_step(pc));
 }
 #else
 void init_difftest(char *ref_so_file, long img_size, int port) { }
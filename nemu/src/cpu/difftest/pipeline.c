@@ -0,0 +1,272 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/difftest.h>
+#include <difftest-def.h>
+#include <pthread.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#ifdef CONFIG_DIFFTEST_PIPELINE
+
+// REF runs on its own thread. The DUT sends commands to it through a
+// single-producer single-consumer ring: the state after each instruction,
+// and every access of the REF made by the DUT or devices. The ref_difftest_*
+// pointers are replaced by functions which send the commands, so REF sees
+// them in the same order as before. Reading the state of REF waits for REF
+// to finish all the commands.
+// REF compares the states by itself and stops at the first mismatch. The
+// DUT notices it at the next instruction, and reports it with the commands
+// before it, which are still in the ring.
+
+#define PIPE_DEPTH 4096
+#define PIPE_HISTORY 32
+
+enum { CMD_STEP, CMD_EXEC, CMD_REGCPY, CMD_MEMCPY, CMD_INTR };
+
+typedef struct {
+  int type;
+  vaddr_t pc;       // STEP
+  uint64_t arg;     // EXEC: number of instructions, MEMCPY: address, INTR: NO
+  size_t len;       // MEMCPY
+  void *data;       // MEMCPY, freed by REF
+  CPU_state state;  // STEP: DUT state after the instruction, REGCPY: the state for REF
+} Cmd;
+
+static Cmd pipe_cmd[PIPE_DEPTH];
+static uint64_t pipe_head = 0; // the next command REF will take
+static uint64_t pipe_tail = 0; // the next command DUT will send
+static bool mismatch = false;
+static uint64_t mismatch_idx = 0;
+static CPU_state mismatch_ref = {};
+
+static void (*real_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) = NULL;
+static void (*real_regcpy)(void *dut, bool direction) = NULL;
+static void (*real_exec)(uint64_t n) = NULL;
+static void (*real_raise_intr)(uint64_t NO) = NULL;
+
+// A thread waiting for the other one spins for a while, and then sleeps on
+// the futex `pipe_event`. The other thread bumps it after making progress,
+// but only if someone sleeps, to keep the syscall out of the fast path.
+#define SPIN_LIMIT 256
+
+typedef struct {
+  int spin;
+  uint32_t event;
+} Waiter;
+
+static uint32_t pipe_event = 0;
+static uint32_t nr_sleeper = 0;
+
+// called each time the condition to wait for is found false
+static void wait_once(Waiter *w) {
+  if (w->spin < SPIN_LIMIT) { w->spin ++; return; }
+  if (w->spin == SPIN_LIMIT) {
+    // the caller checks the condition again before sleeping, so a wakeup
+    // after this is not missed
+    w->event = __atomic_load_n(&pipe_event, __ATOMIC_ACQUIRE);
+    __atomic_add_fetch(&nr_sleeper, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    w->spin ++;
+    return;
+  }
+  syscall(SYS_futex, &pipe_event, FUTEX_WAIT_PRIVATE, w->event, NULL, NULL, 0);
+  w->event = __atomic_load_n(&pipe_event, __ATOMIC_ACQUIRE);
+}
+
+// called when the condition becomes true
+static void wait_end(Waiter *w) {
+  if (w->spin > SPIN_LIMIT) __atomic_sub_fetch(&nr_sleeper, 1, __ATOMIC_RELAXED);
+}
+
+// called after making progress which the other thread may wait for
+static inline void wake() {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (unlikely(__atomic_load_n(&nr_sleeper, __ATOMIC_RELAXED) != 0)) {
+    __atomic_add_fetch(&pipe_event, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &pipe_event, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  }
+}
+
+static void* ref_thread(void *arg) {
+  uint64_t i = 0;
+  while (true) {
+    Waiter w = {};
+    while (i == __atomic_load_n(&pipe_tail, __ATOMIC_ACQUIRE)) wait_once(&w);
+    wait_end(&w);
+    Cmd *c = &pipe_cmd[i % PIPE_DEPTH];
+    switch (c->type) {
+      case CMD_STEP: {
+        CPU_state ref_r;
+        real_exec(1);
+        real_regcpy(&ref_r, DIFFTEST_TO_DUT);
+        if (memcmp(&ref_r, &c->state, DIFFTEST_REG_SIZE) != 0) {
+          mismatch_ref = ref_r;
+          mismatch_idx = i;
+          __atomic_store_n(&mismatch, true, __ATOMIC_RELEASE);
+          wake();
+          return NULL;
+        }
+        break;
+      }
+      case CMD_EXEC: real_exec(c->arg); break;
+      case CMD_REGCPY: real_regcpy(&c->state, DIFFTEST_TO_REF); break;
+      case CMD_MEMCPY: real_memcpy(c->arg, c->data, c->len, DIFFTEST_TO_REF); free(c->data); break;
+      case CMD_INTR: real_raise_intr(c->arg); break;
+      default: assert(0);
+    }
+    __atomic_store_n(&pipe_head, ++ i, __ATOMIC_RELEASE);
+    wake();
+  }
+  return NULL;
+}
+
+static void show_cmd(uint64_t i) {
+  Cmd *c = &pipe_cmd[i % PIPE_DEPTH];
+  switch (c->type) {
+    case CMD_STEP: printf("  #%" PRIu64 ": step at pc = " FMT_WORD "\n", i, c->pc); break;
+    case CMD_EXEC: printf("  #%" PRIu64 ": execute %" PRIu64 " instructions\n", i, c->arg); break;
+    case CMD_REGCPY: printf("  #%" PRIu64 ": copy registers with pc = " FMT_WORD "\n", i, c->state.pc); break;
+    case CMD_MEMCPY: printf("  #%" PRIu64 ": copy %zu bytes to " FMT_PADDR "\n", i, c->len, (paddr_t)c->arg); break;
+    case CMD_INTR: printf("  #%" PRIu64 ": raise interrupt %" PRIu64 "\n", i, c->arg); break;
+  }
+}
+
+static void report_mismatch() {
+  Cmd *c = &pipe_cmd[mismatch_idx % PIPE_DEPTH];
+  uint64_t first = (mismatch_idx > PIPE_HISTORY ? mismatch_idx - PIPE_HISTORY : 0);
+  Log("REF mismatches at pc = " FMT_WORD ", %" PRIu64 " commands behind the DUT. The last commands to REF are:",
+      c->pc, pipe_tail - mismatch_idx);
+  uint64_t i;
+  for (i = first; i <= mismatch_idx; i ++) show_cmd(i);
+  // show the DUT as it was right after the instruction, while memory
+  // already contains the stores of the later instructions
+  cpu = c->state;
+  if (isa_difftest_checkregs(&mismatch_ref, c->pc)) {
+    Log("The difference is not reported by isa_difftest_checkregs()");
+  }
+  isa_reg_display();
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = c->pc;
+}
+
+// return false if a mismatch is found
+static bool check_mismatch() {
+  if (likely(!__atomic_load_n(&mismatch, __ATOMIC_ACQUIRE))) return true;
+  static bool reported = false;
+  if (!reported) { report_mismatch(); reported = true; }
+  return false;
+}
+
+static Cmd* cmd_alloc(int type) {
+  // keep the history of a mismatch from being overwritten
+  Waiter w = {};
+  while (pipe_tail - __atomic_load_n(&pipe_head, __ATOMIC_ACQUIRE) >= PIPE_DEPTH - PIPE_HISTORY) {
+    if (__atomic_load_n(&mismatch, __ATOMIC_ACQUIRE)) { wait_end(&w); return NULL; }
+    wait_once(&w);
+  }
+  wait_end(&w);
+  Cmd *c = &pipe_cmd[pipe_tail % PIPE_DEPTH];
+  c->type = type;
+  return c;
+}
+
+static inline void cmd_send() {
+  __atomic_store_n(&pipe_tail, pipe_tail + 1, __ATOMIC_RELEASE);
+  wake();
+}
+
+// wait for REF to finish all the commands
+bool difftest_pipe_sync() {
+  Waiter w = {};
+  while (__atomic_load_n(&pipe_head, __ATOMIC_ACQUIRE) != pipe_tail) {
+    if (__atomic_load_n(&mismatch, __ATOMIC_ACQUIRE)) break;
+    wait_once(&w);
+  }
+  wait_end(&w);
+  return check_mismatch();
+}
+
+void difftest_pipe_step(vaddr_t pc) {
+  if (!check_mismatch()) return;
+  Cmd *c = cmd_alloc(CMD_STEP);
+  if (c == NULL) return;
+  c->pc = pc;
+  c->state = cpu;
+  cmd_send();
+}
+
+static void pipe_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
+  if (direction == DIFFTEST_TO_DUT) {
+    if (difftest_pipe_sync()) real_memcpy(addr, buf, n, direction);
+    return;
+  }
+  Cmd *c = cmd_alloc(CMD_MEMCPY);
+  if (c == NULL) return;
+  c->arg = addr;
+  c->len = n;
+  c->data = malloc(n);
+  assert(c->data);
+  memcpy(c->data, buf, n);
+  cmd_send();
+}
+
+static void pipe_regcpy(void *dut, bool direction) {
+  if (direction == DIFFTEST_TO_DUT) {
+    if (difftest_pipe_sync()) real_regcpy(dut, direction);
+    return;
+  }
+  Cmd *c = cmd_alloc(CMD_REGCPY);
+  if (c == NULL) return;
+  memcpy(&c->state, dut, DIFFTEST_REG_SIZE);
+  cmd_send();
+}
+
+static void pipe_exec(uint64_t n) {
+  Cmd *c = cmd_alloc(CMD_EXEC);
+  if (c == NULL) return;
+  c->arg = n;
+  cmd_send();
+}
+
+static void pipe_raise_intr(uint64_t NO) {
+  Cmd *c = cmd_alloc(CMD_INTR);
+  if (c == NULL) return;
+  c->arg = NO;
+  cmd_send();
+}
+
+void init_difftest_pipeline() {
+  real_memcpy = ref_difftest_memcpy;
+  real_regcpy = ref_difftest_regcpy;
+  real_exec = ref_difftest_exec;
+  real_raise_intr = ref_difftest_raise_intr;
+  ref_difftest_memcpy = pipe_memcpy;
+  ref_difftest_regcpy = pipe_regcpy;
+  ref_difftest_exec = pipe_exec;
+  ref_difftest_raise_intr = pipe_raise_intr;
+
+  pthread_t tid;
+  int ret = pthread_create(&tid, NULL, ref_thread, NULL);
+  Assert(ret == 0, "Can not create the thread of REF");
+  pthread_detach(tid);
+  Log("REF runs on its own thread, with %d commands in flight at most", PIPE_DEPTH - PIPE_HISTORY);
+}
+
+#endif
@@ -19,20 +19,43 @@
 #include <memory/paddr.h>
 
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) memcpy(guest_to_host(addr), buf, n);
+  else memcpy(buf, guest_to_host(addr), n);
+}
+
+__EXPORT uint64_t difftest_memhash(paddr_t addr, size_t n) {
+  return difftest_hash(guest_to_host(addr), n);
 }
 
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) memcpy(&cpu, dut, DIFFTEST_REG_SIZE);
+  else memcpy(dut, &cpu, DIFFTEST_REG_SIZE);
+}
+
+// only copy the words of the state selected by `mask`
+__EXPORT void difftest_regcpy_mask(void *dut, uint64_t mask) {
+  word_t *src = (word_t *)dut, *dst = (word_t *)&cpu;
+  int i;
+  for (i = 0; mask != 0; i ++, mask >>= 1) {
+    if (mask & 1) dst[i] = src[i];
+  }
 }
 
 __EXPORT void difftest_exec(uint64_t n) {
-  assert(0);
+  cpu_exec(n);
 }
 
 __EXPORT void difftest_raise_intr(word_t NO) {
-  assert(0);
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
+}
+
+#ifdef CONFIG_PMEM_GARRAY
+// `fd` holds the whole memory of the DUT, which is mapped copy-on-write
+__EXPORT void difftest_memshare(paddr_t addr, int fd, size_t n) {
+  assert(addr == CONFIG_MBASE && n == CONFIG_MSIZE);
+  pmem_map_private(fd);
 }
+#endif
 
 __EXPORT void difftest_init(int port) {
   void init_mem();
@@ -15,37 +15,126 @@
 
 #include <common.h>
 #include <device/alarm.h>
-#include <sys/time.h>
-#include <signal.h>
+#include <device/event.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
-#define MAX_HANDLER 8
+// Each alarm is a file descriptor watched by a helper thread. When it
+// becomes readable, the thread only sets the pending bit of the alarm and
+// asks the CPU loop to call event_run() by clearing `g_next_event`. The
+// handlers are then called by alarm_dispatch() on the emulation thread, so
+// they need not be async-safe, and no signal interrupts the system calls of
+// NEMU. The watch is one-shot, so a device re-arms it once it has drained
+// the descriptor, and the helper thread does not spin while the data waits
+// for the emulation thread.
+// The last bit is reserved for the one-shot timerfd of host events.
 
-static alarm_handler_t handler[MAX_HANDLER] = {};
-static int idx = 0;
+#define MAX_ALARM 63
+#define TIMEOUT_BIT (1ull << MAX_ALARM)
 
-void add_alarm_handle(alarm_handler_t h) {
-  assert(idx < MAX_HANDLER);
-  handler[idx ++] = h;
+static alarm_handler_t handler[MAX_ALARM] = {};
+static int watch_fd[MAX_ALARM] = {};
+static int nr_alarm = 0;
+static uint64_t pending = 0;
+static int epfd = -1;
+static int timeout_fd = -1;
+
+static void kick(uint64_t bit) {
+  __atomic_fetch_or(&pending, bit, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&g_next_event, 0, __ATOMIC_SEQ_CST);
 }
 
-static void alarm_sig_handler(int signum) {
-  int i;
-  for (i = 0; i < idx; i ++) {
-    handler[i]();
+static void* alarm_thread(void *arg) {
+  struct epoll_event ev[16];
+  while (true) {
+    int n = epoll_wait(epfd, ev, ARRLEN(ev), -1);
+    int i;
+    for (i = 0; i < n; i ++) {
+      int idx = ev[i].data.u64 >> 32;
+      int fd = (uint32_t)ev[i].data.u64;
+      uint64_t expired;
+      if (idx < MAX_ALARM) kick(1ull << idx);
+      else if (read(fd, &expired, sizeof(expired)) == sizeof(expired)) kick(TIMEOUT_BIT);
+    }
   }
+  return NULL;
+}
+
+static int new_timer(uint32_t idx) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  Assert(fd >= 0, "Can not create timerfd");
+  struct epoll_event ev = { .events = EPOLLIN, .data = { .u64 = ((uint64_t)idx << 32) | fd } };
+  int ret = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+  Assert(ret == 0, "Can not watch timerfd");
+  return fd;
+}
+
+static void watch(int idx, int op) {
+  struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT,
+    .data = { .u64 = ((uint64_t)idx << 32) | (uint32_t)watch_fd[idx] } };
+  int ret = epoll_ctl(epfd, op, watch_fd[idx], &ev);
+  Assert(ret == 0, "Can not watch fd %d", watch_fd[idx]);
+}
+
+int add_alarm_fd(int fd, alarm_handler_t h) {
+  assert(nr_alarm < MAX_ALARM && fd >= 0);
+  int idx = nr_alarm ++;
+  handler[idx] = h;
+  watch_fd[idx] = fd;
+  watch(idx, EPOLL_CTL_ADD);
+  return idx;
+}
+
+void alarm_rearm_fd(int id) {
+  assert(id >= 0 && id < nr_alarm && watch_fd[id] >= 0);
+  watch(id, EPOLL_CTL_MOD);
+}
+
+void alarm_change_fd(int id, int fd) {
+  assert(id >= 0 && id < nr_alarm && fd >= 0);
+  epoll_ctl(epfd, EPOLL_CTL_DEL, watch_fd[id], NULL);
+  watch_fd[id] = fd;
+  watch(id, EPOLL_CTL_ADD);
+}
+
+void alarm_set_timeout(uint64_t us) {
+  struct itimerspec it = {};
+  // a zero it_value disarms the timer, so expire as soon as possible instead
+  if (us == 0) us = 1;
+  it.it_value.tv_sec = us / 1000000;
+  it.it_value.tv_nsec = us % 1000000 * 1000;
+  timerfd_settime(timeout_fd, 0, &it, NULL);
+}
+
+void alarm_cancel_timeout() {
+  struct itimerspec it = {};
+  timerfd_settime(timeout_fd, 0, &it, NULL);
+}
+
+bool alarm_dispatch() {
+  uint64_t p = __atomic_exchange_n(&pending, 0, __ATOMIC_SEQ_CST);
+  uint64_t h = p & ~TIMEOUT_BIT;
+  while (h != 0) {
+    int idx = __builtin_ctzll(h);
+    h &= h - 1;
+    handler[idx]();
+  }
+  return (p & TIMEOUT_BIT) != 0;
+}
+
+bool alarm_pending() {
+  return __atomic_load_n(&pending, __ATOMIC_SEQ_CST) != 0;
 }
 
 void init_alarm() {
-  struct sigaction s;
-  memset(&s, 0, sizeof(s));
-  s.sa_handler = alarm_sig_handler;
-  int ret = sigaction(SIGVTALRM, &s, NULL);
-  Assert(ret == 0, "Can not set signal handler");
-
-  struct itimerval it = {};
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 1000000 / TIMER_HZ;
-  it.it_interval = it.it_value;
-  ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
-  Assert(ret == 0, "Can not set timer");
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  Assert(epfd >= 0, "Can not create epoll instance");
+  timeout_fd = new_timer(MAX_ALARM);
+
+  pthread_t thread;
+  int ret = pthread_create(&thread, NULL, alarm_thread, NULL);
+  Assert(ret == 0, "Can not create alarm thread");
+  pthread_detach(thread);
 }
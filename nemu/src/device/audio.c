@@ -30,12 +30,80 @@ enum {
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
 
+// The stream buffer is a single-producer/single-consumer ring. The guest
+// produces on the emulation thread and publishes the data by writing
+// `reg_count`, which advances `wpos`. The SDL audio callback consumes on
+// the audio thread and advances `rpos`. Both are free-running byte
+// counters, each written by one thread only, so no lock is needed.
+static uint32_t wpos = 0;
+static uint32_t rpos = 0;
+// `rpos` observed by the last guest read of `reg_count`
+static uint32_t count_rpos = 0;
+
+static void audio_play(void *userdata, uint8_t *stream, int len) {
+  uint32_t r = rpos;
+  uint32_t w = __atomic_load_n(&wpos, __ATOMIC_ACQUIRE);
+  uint32_t nread = w - r;
+  if (nread > (uint32_t)len) nread = len;
+
+  uint32_t idx = r % CONFIG_SB_SIZE;
+  uint32_t n = CONFIG_SB_SIZE - idx;
+  if (n > nread) n = nread;
+  memcpy(stream, sbuf + idx, n);
+  memcpy(stream + n, sbuf, nread - n);
+  // fill silence on underrun
+  if (nread < (uint32_t)len) memset(stream + nread, 0, len - nread);
+
+  __atomic_store_n(&rpos, r + nread, __ATOMIC_RELEASE);
+}
+
+static void audio_init() {
+  SDL_AudioSpec s = {};
+  s.freq = audio_base[reg_freq];
+  s.format = AUDIO_S16SYS;
+  s.channels = audio_base[reg_channels];
+  s.samples = audio_base[reg_samples];
+  s.callback = audio_play;
+  s.userdata = NULL;
+
+  SDL_CloseAudio();
+  wpos = rpos = count_rpos = 0;
+  int ret = SDL_InitSubSystem(SDL_INIT_AUDIO);
+  if (ret == 0) ret = SDL_OpenAudio(&s, NULL);
+  if (ret != 0) {
+    Log("Can not open audio device: %s", SDL_GetError());
+    return;
+  }
+  SDL_PauseAudio(0);
+}
+
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
+  switch (offset / sizeof(uint32_t)) {
+    case reg_init:
+      if (is_write && audio_base[reg_init]) audio_init();
+      break;
+    case reg_count:
+      if (is_write) {
+        // The guest writes back the count it read plus the number of bytes
+        // it appended. Data consumed since that read does not matter here.
+        uint32_t appended = audio_base[reg_count] - (wpos - count_rpos);
+        Assert(wpos + appended - __atomic_load_n(&rpos, __ATOMIC_ACQUIRE) <= CONFIG_SB_SIZE,
+            "audio stream buffer overflow");
+        __atomic_store_n(&wpos, wpos + appended, __ATOMIC_RELEASE);
+      } else {
+        count_rpos = __atomic_load_n(&rpos, __ATOMIC_ACQUIRE);
+        audio_base[reg_count] = wpos - count_rpos;
+      }
+      break;
+    default: break;
+  }
 }
 
 void init_audio() {
   uint32_t space_size = sizeof(uint32_t) * nr_reg;
   audio_base = (uint32_t *)new_space(space_size);
+  memset(audio_base, 0, space_size);
+  audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
 #ifdef CONFIG_HAS_PORT_IO
   add_pio_map ("audio", CONFIG_AUDIO_CTL_PORT, audio_base, space_size, audio_io_handler);
 #else
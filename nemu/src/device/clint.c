@@ -0,0 +1,76 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <device/map.h>
+#include <device/event.h>
+
+// SiFive compatible CLINT with a single hart.
+// `mtime` is a virtual clock advanced by guest instructions, so the timer
+// interrupt is deterministic. Writing `mtimecmp` schedules a guest event
+// at the instruction where `mtime` reaches it, and nothing is polled.
+
+#define CLINT_MSIP     0x0000
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME    0xbff8
+#define CLINT_SIZE     0x10000
+
+#define INST_PER_TICK CONFIG_CLINT_INST_PER_TICK
+
+static uint8_t *clint_base = NULL;
+static int mtip_event = -1;
+
+static inline uint64_t mtime() {
+  extern uint64_t g_nr_guest_inst;
+  return g_nr_guest_inst / INST_PER_TICK;
+}
+
+static void set_mtip() {
+  cpu.csr.mip |= MIP_MTIP;
+}
+
+static void update_mtimecmp() {
+  uint64_t mtimecmp = *(uint64_t *)(clint_base + CLINT_MTIMECMP);
+  if (mtimecmp <= mtime()) {
+    set_mtip();
+    event_cancel(mtip_event);
+    return;
+  }
+  cpu.csr.mip &= ~MIP_MTIP;
+  // a large `mtimecmp` is used to disable the timer
+  if (mtimecmp < UINT64_MAX / INST_PER_TICK) event_schedule(mtip_event, mtimecmp * INST_PER_TICK, 0);
+  else event_cancel(mtip_event);
+}
+
+static void clint_io_handler(uint32_t offset, int len, bool is_write) {
+  if (offset >= CLINT_MTIME && offset < CLINT_MTIME + 8) {
+    if (!is_write) *(uint64_t *)(clint_base + CLINT_MTIME) = mtime();
+  } else if (offset >= CLINT_MTIMECMP && offset < CLINT_MTIMECMP + 8) {
+    if (is_write) update_mtimecmp();
+  } else if (offset == CLINT_MSIP) {
+    if (is_write) {
+      if (clint_base[CLINT_MSIP] & 1) cpu.csr.mip |= MIP_MSIP;
+      else cpu.csr.mip &= ~MIP_MSIP;
+    }
+  }
+}
+
+void init_clint() {
+  clint_base = new_space(CLINT_SIZE);
+  memset(clint_base, 0, CLINT_SIZE);
+  *(uint64_t *)(clint_base + CLINT_MTIMECMP) = UINT64_MAX;
+  add_mmio_map("clint", CONFIG_CLINT_MMIO, clint_base, CLINT_SIZE, clint_io_handler);
+  mtip_event = event_register("clint", EVENT_GUEST, set_mtip);
+}
@@ -16,9 +16,7 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
-#ifndef CONFIG_TARGET_AM
-#include <SDL2/SDL.h>
-#endif
+#include <device/event.h>
 
 void init_map();
 void init_serial();
@@ -28,54 +26,42 @@ void init_i8042();
 void init_audio();
 void init_disk();
 void init_sdcard();
+void init_clint();
+void init_plic();
+void init_virtio_blk();
+void init_virtio_console();
+void init_nic();
 void init_alarm();
+void init_plugins();
 
-void send_key(uint8_t, bool);
 void vga_update_screen();
 
-void device_update() {
-  static uint64_t last = 0;
-  uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
-    return;
-  }
-  last = now;
+// SDL events are handled by the display thread in vga.c, which only
+// requests the emulation thread to quit when the window is closed
+static bool quit_requested = false;
+
+void sdl_request_quit() {
+  __atomic_store_n(&quit_requested, true, __ATOMIC_RELAXED);
+}
 
+// called by the event scheduler at TIMER_HZ
+static void device_update() {
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
 
-#ifndef CONFIG_TARGET_AM
-  SDL_Event event;
-  while (SDL_PollEvent(&event)) {
-    switch (event.type) {
-      case SDL_QUIT:
-        nemu_state.state = NEMU_QUIT;
-        break;
-#ifdef CONFIG_HAS_KEYBOARD
-      // If a key was pressed
-      case SDL_KEYDOWN:
-      case SDL_KEYUP: {
-        uint8_t k = event.key.keysym.scancode;
-        bool is_keydown = (event.key.type == SDL_KEYDOWN);
-        send_key(k, is_keydown);
-        break;
-      }
-#endif
-      default: break;
-    }
+  if (__atomic_exchange_n(&quit_requested, false, __ATOMIC_RELAXED)) {
+    nemu_state.state = NEMU_QUIT;
   }
-#endif
 }
 
+// discard the quit request made while the monitor was waiting for commands
 void sdl_clear_event_queue() {
-#ifndef CONFIG_TARGET_AM
-  SDL_Event event;
-  while (SDL_PollEvent(&event));
-#endif
+  __atomic_store_n(&quit_requested, false, __ATOMIC_RELAXED);
 }
 
 void init_device() {
   IFDEF(CONFIG_TARGET_AM, ioe_init());
   init_map();
+  IFNDEF(CONFIG_TARGET_AM, init_alarm());
 
   IFDEF(CONFIG_HAS_SERIAL, init_serial());
   IFDEF(CONFIG_HAS_TIMER, init_timer());
@@ -84,6 +70,13 @@ void init_device() {
   IFDEF(CONFIG_HAS_AUDIO, init_audio());
   IFDEF(CONFIG_HAS_DISK, init_disk());
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
+  IFDEF(CONFIG_HAS_CLINT, init_clint());
+  IFDEF(CONFIG_HAS_PLIC, init_plic());
+  IFDEF(CONFIG_HAS_VIRTIO_BLK, init_virtio_blk());
+  IFDEF(CONFIG_HAS_VIRTIO_CONSOLE, init_virtio_console());
+  IFDEF(CONFIG_HAS_NIC, init_nic());
+  IFDEF(CONFIG_PLUGIN, init_plugins());
 
-  IFNDEF(CONFIG_TARGET_AM, init_alarm());
+  int id = event_register("device", EVENT_HOST, device_update);
+  event_schedule(id, get_time(), 1000000 / TIMER_HZ);
 }
@@ -14,6 +14,91 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// The disk image is mapped into the address space of NEMU. A transfer of
+// any number of blocks is started by writing `reg_cmd`, and is performed by
+// a single memcpy() between the image and the guest buffer in pmem.
+
+#define BLKSZ 512
+
+enum {
+  reg_present,
+  reg_blksz,
+  reg_blkcnt,
+  reg_buf,    // guest physical address of the buffer
+  reg_blkno,
+  reg_count,  // number of blocks to transfer
+  reg_write,
+  reg_cmd,
+  nr_reg
+};
+
+static uint32_t *disk_base = NULL;
+static uint8_t *img = NULL;
+static size_t img_size = 0;
+
+static void disk_transfer() {
+  paddr_t buf = disk_base[reg_buf];
+  uint64_t offset = (uint64_t)disk_base[reg_blkno] * BLKSZ;
+  uint64_t len = (uint64_t)disk_base[reg_count] * BLKSZ;
+  bool is_write = disk_base[reg_write];
+  if (len == 0) return;
+
+  Assert(img != NULL, "disk is not present");
+  Assert(offset <= img_size && len <= img_size - offset, "disk access [%" PRIu64 ", %" PRIu64 ") "
+      "is out of bound [0, %zu)", offset, offset + len, img_size);
+  Assert(buf - CONFIG_MBASE < CONFIG_MSIZE && len <= CONFIG_MSIZE - (buf - CONFIG_MBASE),
+      "disk buffer [" FMT_PADDR ", 0x%" PRIx64 ") is out of bound of pmem", buf, buf + len);
+
+  if (is_write) { memcpy(img + offset, guest_to_host(buf), len); }
+  else {
+    memcpy(guest_to_host(buf), img + offset, len);
+    // the REF can not see this DMA, so bring the data to it as well
+    IFDEF(CONFIG_DIFFTEST, ref_difftest_memcpy(buf, guest_to_host(buf), len, DIFFTEST_TO_REF));
+  }
+}
+
+static void disk_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write && offset / sizeof(uint32_t) == reg_cmd) {
+    disk_transfer();
+    disk_base[reg_cmd] = 0;
+  }
+}
+
+static void init_img(const char *path) {
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    Log("Can not open disk image: %s", path);
+    return;
+  }
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  img_size = st.st_size;
+  img = (uint8_t *)mmap(NULL, img_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Assert(img != MAP_FAILED, "Can not map disk image: %s", path);
+  close(fd);
+  Log("Disk image %s, size = %zu", path, img_size);
+}
 
 void init_disk() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  disk_base = (uint32_t *)new_space(space_size);
+  memset(disk_base, 0, space_size);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("disk", CONFIG_DISK_CTL_PORT, disk_base, space_size, disk_io_handler);
+#else
+  add_mmio_map("disk", CONFIG_DISK_CTL_MMIO, disk_base, space_size, disk_io_handler);
+#endif
+
+  const char *path = CONFIG_DISK_IMG_PATH;
+  if (path[0] != '\0') init_img(path);
+  disk_base[reg_present] = (img != NULL);
+  disk_base[reg_blksz] = BLKSZ;
+  disk_base[reg_blkcnt] = img_size / BLKSZ;
 }
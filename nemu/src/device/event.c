@@ -0,0 +1,196 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/event.h>
+#include <device/alarm.h>
+#include <utils.h>
+
+// Pending events of each clock are kept in a min-heap ordered by deadline.
+// The CPU loop only compares the number of executed instructions against
+// `g_next_event`, which is the earliest guest deadline. Host deadlines can
+// not be converted to instructions, so the alarm thread is asked to clear
+// `g_next_event` at the earliest host deadline. Without the alarm thread
+// (TARGET_AM), the host clock is sampled every HOST_QUANTUM instructions.
+
+#define HOST_QUANTUM 4096
+
+typedef struct {
+  const char *name;
+  event_handler_t handler;
+  uint64_t deadline;
+  uint64_t period;
+  int clock;
+  int heap_idx; // -1 if the event is not pending
+} Event;
+
+typedef struct {
+  int *id;
+  int size;
+} Heap;
+
+uint64_t g_next_event = UINT64_MAX;
+extern uint64_t g_nr_guest_inst;
+
+static Event *events = NULL;
+static int nr_event = 0;
+static Heap heap[NR_EVENT_CLOCK] = {};
+IFNDEF(CONFIG_TARGET_AM, static uint64_t host_armed = UINT64_MAX);
+
+static inline uint64_t deadline(Heap *h, int i) { return events[h->id[i]].deadline; }
+
+static void heap_set(Heap *h, int i, int id) {
+  h->id[i] = id;
+  events[id].heap_idx = i;
+}
+
+static void sift_up(Heap *h, int i) {
+  int id = h->id[i];
+  while (i > 0) {
+    int p = (i - 1) / 2;
+    if (deadline(h, p) <= events[id].deadline) break;
+    heap_set(h, i, h->id[p]);
+    i = p;
+  }
+  heap_set(h, i, id);
+}
+
+static void sift_down(Heap *h, int i) {
+  int id = h->id[i];
+  while (true) {
+    int c = 2 * i + 1;
+    if (c >= h->size) break;
+    if (c + 1 < h->size && deadline(h, c + 1) < deadline(h, c)) c ++;
+    if (events[id].deadline <= deadline(h, c)) break;
+    heap_set(h, i, h->id[c]);
+    i = c;
+  }
+  heap_set(h, i, id);
+}
+
+static void heap_remove(Heap *h, int i) {
+  int last = h->id[-- h->size];
+  events[h->id[i]].heap_idx = -1;
+  if (i == h->size) return;
+  heap_set(h, i, last);
+  sift_down(h, i);
+  sift_up(h, events[last].heap_idx);
+}
+
+static void update_next_event() {
+  Heap *g = &heap[EVENT_GUEST];
+  Heap *h = &heap[EVENT_HOST];
+  uint64_t next = (g->size > 0 ? deadline(g, 0) : UINT64_MAX);
+#ifdef CONFIG_TARGET_AM
+  if (h->size > 0) {
+    uint64_t host_next = g_nr_guest_inst + HOST_QUANTUM;
+    if (host_next < next) next = host_next;
+  }
+  g_next_event = next;
+#else
+  if (h->size > 0) {
+    uint64_t host_next = deadline(h, 0);
+    if (host_next != host_armed) {
+      uint64_t now = get_time();
+      alarm_set_timeout(host_next > now ? host_next - now : 0);
+      host_armed = host_next;
+    }
+  } else if (host_armed != UINT64_MAX) {
+    alarm_cancel_timeout();
+    host_armed = UINT64_MAX;
+  }
+  __atomic_store_n(&g_next_event, next, __ATOMIC_SEQ_CST);
+  // the alarm thread may have cleared `g_next_event` before the store above
+  if (alarm_pending()) __atomic_store_n(&g_next_event, 0, __ATOMIC_SEQ_CST);
+#endif
+}
+
+uint64_t event_now(int clock) {
+  return (clock == EVENT_GUEST ? g_nr_guest_inst : get_time());
+}
+
+int event_register(const char *name, int clock, event_handler_t h) {
+  assert(clock >= 0 && clock < NR_EVENT_CLOCK);
+  int id = nr_event ++;
+  events = (Event *)realloc(events, sizeof(Event) * nr_event);
+  assert(events);
+  events[id] = (Event) { .name = name, .handler = h, .clock = clock, .heap_idx = -1 };
+  int i;
+  for (i = 0; i < NR_EVENT_CLOCK; i ++) {
+    heap[i].id = (int *)realloc(heap[i].id, sizeof(int) * nr_event);
+    assert(heap[i].id);
+  }
+  return id;
+}
+
+bool event_valid(int id) {
+  return id >= 0 && id < nr_event;
+}
+
+void event_schedule(int id, uint64_t when, uint64_t period) {
+  assert(id >= 0 && id < nr_event);
+  Event *e = &events[id];
+  Heap *h = &heap[e->clock];
+  e->deadline = when;
+  e->period = period;
+  if (e->heap_idx >= 0) {
+    sift_down(h, e->heap_idx);
+    sift_up(h, e->heap_idx);
+  } else {
+    h->id[h->size] = id;
+    sift_up(h, h->size ++);
+  }
+  update_next_event();
+}
+
+void event_cancel(int id) {
+  assert(id >= 0 && id < nr_event);
+  Event *e = &events[id];
+  if (e->heap_idx >= 0) {
+    heap_remove(&heap[e->clock], e->heap_idx);
+    update_next_event();
+  }
+}
+
+static void run_expired(int clock) {
+  Heap *h = &heap[clock];
+  if (h->size == 0) return;
+  uint64_t now = event_now(clock);
+  while (h->size > 0 && deadline(h, 0) <= now) {
+    int id = h->id[0];
+    Event *e = &events[id];
+    if (e->period != 0) {
+      // do not try to catch up with the missed periods
+      e->deadline += e->period;
+      if (e->deadline <= now) e->deadline = now + e->period;
+      sift_down(h, 0);
+    } else {
+      heap_remove(h, 0);
+    }
+    // the handler may schedule or cancel events, including itself
+    e->handler();
+  }
+}
+
+void event_run() {
+#ifndef CONFIG_TARGET_AM
+  // the host clock may be too coarse to see the deadline, so arm again
+  if (alarm_dispatch()) host_armed = UINT64_MAX;
+#endif
+  int i;
+  for (i = 0; i < NR_EVENT_CLOCK; i ++) {
+    run_expired(i);
+  }
+  update_next_event();
+}
@@ -14,7 +14,7 @@
 #**************************************************************************************/
 
 DIRS-y += src/device/io
-SRCS-$(CONFIG_DEVICE) += src/device/device.c src/device/alarm.c src/device/intr.c
+SRCS-$(CONFIG_DEVICE) += src/device/device.c src/device/alarm.c src/device/intr.c src/device/event.c
 SRCS-$(CONFIG_HAS_SERIAL) += src/device/serial.c
 SRCS-$(CONFIG_HAS_TIMER) += src/device/timer.c
 SRCS-$(CONFIG_HAS_KEYBOARD) += src/device/keyboard.c
@@ -22,11 +22,20 @@ SRCS-$(CONFIG_HAS_VGA) += src/device/vga.c
 SRCS-$(CONFIG_HAS_AUDIO) += src/device/audio.c
 SRCS-$(CONFIG_HAS_DISK) += src/device/disk.c
 SRCS-$(CONFIG_HAS_SDCARD) += src/device/sdcard.c
+SRCS-$(CONFIG_HAS_CLINT) += src/device/clint.c
+SRCS-$(CONFIG_HAS_PLIC) += src/device/plic.c
+SRCS-$(CONFIG_HAS_VIRTIO) += src/device/virtio/virtio.c
+SRCS-$(CONFIG_HAS_VIRTIO_BLK) += src/device/virtio/blk.c
+SRCS-$(CONFIG_HAS_VIRTIO_CONSOLE) += src/device/virtio/console.c
+SRCS-$(CONFIG_HAS_NIC) += src/device/nic.c
+SRCS-$(CONFIG_PLUGIN) += src/device/plugin.c
 
 SRCS-BLACKLIST-$(CONFIG_TARGET_AM) += src/device/alarm.c
 
 ifdef CONFIG_DEVICE
 ifndef CONFIG_TARGET_AM
-LIBS += -lSDL2
+LIBS += -lpthread
+LIBS += $(if $(CONFIG_HAS_KEYBOARD)$(CONFIG_HAS_AUDIO)$(CONFIG_VGA_SHOW_SCREEN),-lSDL2,)
+LIBS += $(if $(CONFIG_VGA_HEADLESS_SHM),-lrt,)
 endif
 endif
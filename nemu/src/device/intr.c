@@ -14,6 +14,13 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <device/intr.h>
+
+void plic_set_irq(int irq, bool level);
 
 void dev_raise_intr() {
 }
+
+void dev_set_irq(int irq, bool level) {
+  IFDEF(CONFIG_HAS_PLIC, plic_set_irq(irq, level));
+}
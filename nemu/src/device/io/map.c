@@ -56,6 +56,11 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  if (map->bulk != NULL) {
+    word_t ret = 0;
+    map->bulk(map->opaque, offset, &ret, len, false);
+    return ret;
+  }
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
   return ret;
@@ -65,6 +70,10 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  if (map->bulk != NULL) {
+    map->bulk(map->opaque, offset, &data, len, true);
+    return;
+  }
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
 }
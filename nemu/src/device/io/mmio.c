@@ -14,9 +14,10 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/mmio.h>
 #include <memory/paddr.h>
 
-#define NR_MAP 16
+#define NR_MAP 32
 
 static IOMap maps[NR_MAP] = {};
 static int nr_map = 0;
@@ -33,7 +34,7 @@ static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
 }
 
 /* device interface */
-void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_callback_t callback) {
+static IOMap* new_mmio_map(const char *name, paddr_t addr, uint32_t len) {
   assert(nr_map < NR_MAP);
   paddr_t left = addr, right = addr + len - 1;
   if (in_pmem(left) || in_pmem(right)) {
@@ -45,12 +46,28 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
     }
   }
 
-  maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
-    .space = space, .callback = callback };
+  maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1 };
   Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
       maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
 
-  nr_map ++;
+  return &maps[nr_map ++];
+}
+
+void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_callback_t callback) {
+  IOMap *map = new_mmio_map(name, addr, len);
+  map->space = space;
+  map->callback = callback;
+}
+
+void add_mmio_map_bulk(const char *name, paddr_t addr, uint32_t len,
+    io_bulk_callback_t bulk, void *opaque) {
+  IOMap *map = new_mmio_map(name, addr, len);
+  map->bulk = bulk;
+  map->opaque = opaque;
+}
+
+bool mmio_map_full() {
+  return nr_map == NR_MAP;
 }
 
 /* bus interface */
@@ -61,3 +78,27 @@ word_t mmio_read(paddr_t addr, int len) {
 void mmio_write(paddr_t addr, int len, word_t data) {
   map_write(addr, len, data, fetch_mmio_map(addr));
 }
+
+bool mmio_bulk_access(paddr_t addr, void *buf, uint32_t len, bool is_write) {
+  // bus masters are not the CPU, so the REF is not asked to skip the instruction
+  IOMap *map = NULL;
+  int i;
+  for (i = 0; i < nr_map; i ++) {
+    if (map_inside(&maps[i], addr)) { map = &maps[i]; break; }
+  }
+  if (map == NULL || len - 1 > map->high - addr) return false;
+  if (map->bulk != NULL) {
+    map->bulk(map->opaque, addr - map->low, buf, len, is_write);
+    return true;
+  }
+  // maps with a plain callback are accessed a word at a time
+  uint8_t *p = (uint8_t *)buf;
+  while (len > 0) {
+    int n = (len >= sizeof(word_t) ? sizeof(word_t) : 1);
+    word_t data = 0;
+    if (is_write) { memcpy(&data, p, n); map_write(addr, n, data, map); }
+    else { data = map_read(addr, n, map); memcpy(p, &data, n); }
+    addr += n; p += n; len -= n;
+  }
+  return true;
+}
@@ -45,22 +45,39 @@ static void init_keymap() {
   MAP(NEMU_KEYS, SDL_KEYMAP)
 }
 
+// Keys are enqueued by the display thread (see vga.c) and dequeued by the
+// emulation thread, so each index is written by one side only and published
+// with release/acquire ordering. Keys arriving when the queue is full are
+// dropped and counted, since input can be injected faster than it is read.
 #define KEY_QUEUE_LEN 1024
-static int key_queue[KEY_QUEUE_LEN] = {};
-static int key_f = 0, key_r = 0;
+static uint32_t key_queue[KEY_QUEUE_LEN] = {};
+static uint32_t key_f = 0, key_r = 0;
+static uint32_t key_dropped = 0;
 
 static void key_enqueue(uint32_t am_scancode) {
+  uint32_t next = (key_r + 1) % KEY_QUEUE_LEN;
+  if (next == __atomic_load_n(&key_f, __ATOMIC_ACQUIRE)) {
+    __atomic_fetch_add(&key_dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
   key_queue[key_r] = am_scancode;
-  key_r = (key_r + 1) % KEY_QUEUE_LEN;
-  Assert(key_r != key_f, "key queue overflow!");
+  __atomic_store_n(&key_r, next, __ATOMIC_RELEASE);
+}
+
+static uint32_t key_dequeue_batch(uint32_t *buf, uint32_t max) {
+  uint32_t r = __atomic_load_n(&key_r, __ATOMIC_ACQUIRE);
+  uint32_t n = (r + KEY_QUEUE_LEN - key_f) % KEY_QUEUE_LEN;
+  if (n > max) n = max;
+  for (uint32_t i = 0; i < n; i ++) {
+    buf[i] = key_queue[(key_f + i) % KEY_QUEUE_LEN];
+  }
+  __atomic_store_n(&key_f, (key_f + n) % KEY_QUEUE_LEN, __ATOMIC_RELEASE);
+  return n;
 }
 
 static uint32_t key_dequeue() {
   uint32_t key = NEMU_KEY_NONE;
-  if (key_f != key_r) {
-    key = key_queue[key_f];
-    key_f = (key_f + 1) % KEY_QUEUE_LEN;
-  }
+  key_dequeue_batch(&key, 1);
   return key;
 }
 
@@ -78,23 +95,51 @@ static uint32_t key_dequeue() {
   uint32_t am_scancode = ev.keycode | (ev.keydown ? KEYDOWN_MASK : 0);
   return am_scancode;
 }
+
+static uint32_t key_dequeue_batch(uint32_t *buf, uint32_t max) {
+  uint32_t n;
+  for (n = 0; n < max; n ++) {
+    buf[n] = key_dequeue();
+    if (buf[n] == NEMU_KEY_NONE) break;
+  }
+  return n;
+}
+
+static uint32_t key_dropped = 0;
 #endif
 
+// Reading `reg_data` pops one key as before. Reading `reg_count` pops up to
+// KEY_BATCH keys into `reg_batch` and returns their number, so that the
+// guest can drain a burst of input with one access plus plain loads.
+#define KEY_BATCH 32
+
+enum { reg_data, reg_count, reg_dropped, reg_batch = 4, nr_reg = reg_batch + KEY_BATCH };
+
 static uint32_t *i8042_data_port_base = NULL;
 
 static void i8042_data_io_handler(uint32_t offset, int len, bool is_write) {
-  assert(!is_write);
-  assert(offset == 0);
-  i8042_data_port_base[0] = key_dequeue();
+  if (is_write) return;
+  switch (offset / 4) {
+    case reg_data: i8042_data_port_base[reg_data] = key_dequeue(); break;
+    case reg_count:
+      i8042_data_port_base[reg_count] =
+        key_dequeue_batch(i8042_data_port_base + reg_batch, KEY_BATCH);
+      break;
+    case reg_dropped:
+      i8042_data_port_base[reg_dropped] = __atomic_load_n(&key_dropped, __ATOMIC_RELAXED);
+      break;
+    default: break;
+  }
 }
 
 void init_i8042() {
-  i8042_data_port_base = (uint32_t *)new_space(4);
-  i8042_data_port_base[0] = NEMU_KEY_NONE;
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  i8042_data_port_base = (uint32_t *)new_space(space_size);
+  memset(i8042_data_port_base, 0, space_size);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("keyboard", CONFIG_I8042_DATA_PORT, i8042_data_port_base, 4, i8042_data_io_handler);
+  add_pio_map ("keyboard", CONFIG_I8042_DATA_PORT, i8042_data_port_base, space_size, i8042_data_io_handler);
 #else
-  add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, i8042_data_io_handler);
+  add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, space_size, i8042_data_io_handler);
 #endif
   IFNDEF(CONFIG_TARGET_AM, init_keymap());
 }
@@ -0,0 +1,244 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/map.h>
+#include <device/alarm.h>
+#include <device/event.h>
+#include <device/intr.h>
+#include <memory/paddr.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// A NIC with TX/RX descriptor rings in guest memory. Each frame is a
+// datagram of a UNIX socket bound to CONFIG_NIC_SOCKET_PATH, and frames are
+// sent to CONFIG_NIC_PEER_PATH. Two instances of NEMU can be connected by
+// swapping the paths. Frames are moved between the socket and the guest
+// buffers directly, so the only copy is made by the host kernel.
+//
+// Ring indices are free-running, and descriptor i is at base + (i % size) * 16.
+// The guest produces TX frames and empty RX buffers by advancing the tail,
+// and the device consumes them by advancing the head. A finished
+// descriptor has NIC_DESC_DONE set, and the length of a received frame.
+//
+// The interrupt is coalesced: it is raised when `coal_frames` frames have
+// finished, or `coal_delay` guest instructions after the first unreported
+// frame, whichever comes first.
+
+#define NIC_MAX_FRAME 2048
+#define NIC_DESC_DONE  0x1
+#define NIC_DESC_ERROR 0x2 // the frame is dropped, or truncated by RX
+#define NIC_INT_TX 0x1
+#define NIC_INT_RX 0x2
+// retry the sending when the queue of the peer is full
+#define TX_RETRY_US 100
+
+typedef struct {
+  uint64_t addr;
+  uint32_t len;
+  uint32_t flags;
+} NICDesc;
+
+enum {
+  reg_ctrl,        // bit 0: enable, writing 0 resets the rings
+  reg_isr,         // pending interrupts, write 1 to clear
+  reg_imask,
+  reg_coal_delay,
+  reg_tx_base, reg_tx_size, reg_tx_tail, reg_tx_head,
+  reg_rx_base, reg_rx_size, reg_rx_tail, reg_rx_head,
+  reg_coal_frames,
+  reg_tx_dropped,  // no peer, or too long
+  reg_rx_dropped,  // truncated
+  nr_reg
+};
+
+static uint32_t *nic_base = NULL;
+static int sock = -1;
+static struct sockaddr_un peer = {};
+static int rx_watch = -1;
+static bool rx_watching = false;
+static int coal_event = -1;
+static int tx_event = -1;
+static uint32_t isr = 0;
+static uint32_t nr_unreported = 0;
+static bool irq_raised = false;
+
+static void update_irq() {
+  bool level = irq_raised && (isr & nic_base[reg_imask]) != 0;
+  dev_set_irq(CONFIG_NIC_IRQ, level);
+}
+
+static void raise_irq() {
+  event_cancel(coal_event);
+  nr_unreported = 0;
+  irq_raised = true;
+  update_irq();
+}
+
+static void frame_done(uint32_t cause) {
+  isr |= cause;
+  nic_base[reg_isr] = isr;
+  uint32_t threshold = (nic_base[reg_coal_frames] == 0 ? 1 : nic_base[reg_coal_frames]);
+  if (++ nr_unreported >= threshold || nic_base[reg_coal_delay] == 0) raise_irq();
+  else if (nr_unreported == 1) {
+    event_schedule(coal_event, event_now(EVENT_GUEST) + nic_base[reg_coal_delay], 0);
+  }
+}
+
+static NICDesc* desc(int base_reg, uint32_t idx) {
+  uint32_t size = nic_base[base_reg + 1];
+  uint64_t addr = (uint64_t)nic_base[base_reg] + (idx % size) * sizeof(NICDesc);
+  Assert(addr - CONFIG_MBASE < CONFIG_MSIZE && sizeof(NICDesc) <= CONFIG_MSIZE - (addr - CONFIG_MBASE),
+      "nic descriptor at 0x%" PRIx64 " is out of bound", addr);
+  return (NICDesc *)guest_to_host(addr);
+}
+
+// NULL if the buffer is not inside the memory, and the frame is then dropped
+static uint8_t* frame_buf(NICDesc *d, uint32_t len) {
+  uint64_t off = d->addr - CONFIG_MBASE;
+  if (off >= CONFIG_MSIZE || len > CONFIG_MSIZE - off) return NULL;
+  return guest_to_host(d->addr);
+}
+
+static void desc_writeback(NICDesc *d) {
+  IFDEF(CONFIG_DIFFTEST, ref_difftest_memcpy(host_to_guest((uint8_t *)d), d, sizeof(*d), DIFFTEST_TO_REF));
+}
+
+static inline bool enabled() {
+  return (nic_base[reg_ctrl] & 1) && nic_base[reg_tx_size] != 0 && nic_base[reg_rx_size] != 0;
+}
+
+static void nic_tx() {
+  if (!enabled()) return;
+  uint32_t *head = &nic_base[reg_tx_head];
+  while (*head != nic_base[reg_tx_tail]) {
+    NICDesc *d = desc(reg_tx_base, *head);
+    uint32_t len = d->len;
+    uint8_t *buf = (len > 0 && len <= NIC_MAX_FRAME ? frame_buf(d, len) : NULL);
+    bool ok = (buf != NULL);
+    if (ok) {
+      ssize_t ret = sendto(sock, buf, len, 0, (struct sockaddr *)&peer, sizeof(peer));
+      if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        event_schedule(tx_event, event_now(EVENT_HOST) + TX_RETRY_US, 0);
+        break;
+      }
+      // like an unplugged cable, the frame is lost if there is no peer
+      ok = (ret >= 0);
+    }
+    if (!ok) nic_base[reg_tx_dropped] ++;
+    d->flags = NIC_DESC_DONE | (ok ? 0 : NIC_DESC_ERROR);
+    desc_writeback(d);
+    (*head) ++;
+    frame_done(NIC_INT_TX);
+  }
+}
+
+static void nic_rx() {
+  uint32_t *head = &nic_base[reg_rx_head];
+  if (!enabled()) {
+    // the receiver is off, so drop the frames
+    static uint8_t discard[NIC_MAX_FRAME];
+    while (recv(sock, discard, sizeof(discard), 0) >= 0) ;
+  } else {
+    while (*head != nic_base[reg_rx_tail]) {
+      NICDesc *d = desc(reg_rx_base, *head);
+      uint32_t cap = (d->len > NIC_MAX_FRAME ? NIC_MAX_FRAME : d->len);
+      uint8_t *buf = (cap == 0 ? NULL : frame_buf(d, cap));
+      // a zero-length or invalid buffer only drops the frame
+      bool bad = (cap > 0 && buf == NULL);
+      if (bad) cap = 0;
+      ssize_t ret = recv(sock, buf, cap, MSG_TRUNC);
+      if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        panic("nic: can not receive: %s", strerror(errno));
+      }
+      d->flags = NIC_DESC_DONE;
+      if ((uint32_t)ret > cap || bad) { d->flags |= NIC_DESC_ERROR; nic_base[reg_rx_dropped] ++; ret = cap; }
+      d->len = ret;
+      IFDEF(CONFIG_DIFFTEST, if (ret > 0) ref_difftest_memcpy(d->addr, guest_to_host(d->addr), ret, DIFFTEST_TO_REF));
+      desc_writeback(d);
+      (*head) ++;
+      frame_done(NIC_INT_RX);
+    }
+    // frames stay in the socket until the guest provides more buffers,
+    // and the sender is then throttled by the kernel
+    if (*head == nic_base[reg_rx_tail]) { rx_watching = false; return; }
+  }
+  alarm_rearm_fd(rx_watch);
+  rx_watching = true;
+}
+
+static void nic_rx_ready() {
+  rx_watching = false;
+  nic_rx();
+}
+
+static void try_rx() {
+  if (!rx_watching) nic_rx();
+}
+
+static void nic_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write) return;
+  switch (offset / 4) {
+    case reg_ctrl:
+      if (!(nic_base[reg_ctrl] & 1)) {
+        nic_base[reg_tx_head] = nic_base[reg_tx_tail] = 0;
+        nic_base[reg_rx_head] = nic_base[reg_rx_tail] = 0;
+        event_cancel(tx_event);
+      }
+      nic_tx();
+      try_rx();
+      break;
+    case reg_isr:
+      isr &= ~nic_base[reg_isr];
+      nic_base[reg_isr] = isr;
+      if ((isr & nic_base[reg_imask]) == 0) irq_raised = false;
+      update_irq();
+      break;
+    case reg_imask: update_irq(); break;
+    case reg_tx_tail: nic_tx(); break;
+    case reg_rx_tail: try_rx(); break;
+    default: break;
+  }
+}
+
+static void init_socket() {
+  const char *path = CONFIG_NIC_SOCKET_PATH;
+  sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  Assert(sock >= 0, "Can not create socket for nic");
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  unlink(path);
+  int ret = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+  Assert(ret == 0, "Can not bind nic to '%s': %s", path, strerror(errno));
+
+  peer.sun_family = AF_UNIX;
+  strncpy(peer.sun_path, CONFIG_NIC_PEER_PATH, sizeof(peer.sun_path) - 1);
+  Log("nic: receive at '%s', send to '%s'", path, CONFIG_NIC_PEER_PATH);
+}
+
+void init_nic() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  nic_base = (uint32_t *)new_space(space_size);
+  memset(nic_base, 0, space_size);
+  add_mmio_map("nic", CONFIG_NIC_MMIO, nic_base, space_size, nic_io_handler);
+
+  init_socket();
+  coal_event = event_register("nic-coalesce", EVENT_GUEST, raise_irq);
+  tx_event = event_register("nic-tx", EVENT_HOST, nic_tx);
+  rx_watch = add_alarm_fd(sock, nic_rx_ready);
+  rx_watching = true;
+}
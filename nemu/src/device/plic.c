@@ -0,0 +1,112 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <device/map.h>
+#include <device/intr.h>
+
+// SiFive compatible PLIC with level-triggered sources and a single
+// context (M-mode of hart 0), which drives MEIP in mip.
+// Only the implemented part of the register file is mapped: the source
+// registers at [0, 0x3000) and the context registers at 0x200000.
+
+#define NR_SOURCE NR_IRQ
+
+#define PLIC_PRIORITY  0x0000
+#define PLIC_PENDING   0x1000
+#define PLIC_ENABLE    0x2000
+#define PLIC_SRC_SIZE  0x3000
+#define PLIC_CONTEXT   0x200000
+#define PLIC_CTX_SIZE  0x1000
+
+enum { reg_threshold, reg_claim };
+
+static uint32_t *src_base = NULL;
+static uint32_t *ctx_base = NULL;
+static uint32_t level = 0;      // current levels of the source lines
+static uint32_t pending = 0;
+static uint32_t in_service = 0; // claimed but not completed
+
+static int best_source() {
+  uint32_t *priority = src_base + PLIC_PRIORITY / 4;
+  uint32_t p = pending & src_base[PLIC_ENABLE / 4] & ~1u;
+  int best = 0;
+  uint32_t best_prio = ctx_base[reg_threshold];
+  while (p != 0) {
+    int i = __builtin_ctz(p);
+    p &= p - 1;
+    if (priority[i] > best_prio) { best = i; best_prio = priority[i]; }
+  }
+  return best;
+}
+
+static void update_meip() {
+  src_base[PLIC_PENDING / 4] = pending;
+  if (best_source() != 0) cpu.csr.mip |= MIP_MEIP;
+  else cpu.csr.mip &= ~MIP_MEIP;
+}
+
+void plic_set_irq(int irq, bool lvl) {
+  assert(irq > 0 && irq < NR_SOURCE);
+  uint32_t mask = 1u << irq;
+  if (lvl) {
+    level |= mask;
+    if (!(in_service & mask)) pending |= mask;
+  } else {
+    level &= ~mask;
+    pending &= ~mask;
+  }
+  update_meip();
+}
+
+static void plic_src_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write) return;
+  if (offset >= PLIC_PENDING && offset < PLIC_ENABLE) {
+    src_base[PLIC_PENDING / 4] = pending; // read-only
+  }
+  update_meip();
+}
+
+static void plic_ctx_io_handler(uint32_t offset, int len, bool is_write) {
+  if (offset / 4 != reg_claim) {
+    if (is_write) update_meip();
+    return;
+  }
+  if (!is_write) {
+    int irq = best_source();
+    ctx_base[reg_claim] = irq;
+    if (irq != 0) {
+      pending &= ~(1u << irq);
+      in_service |= 1u << irq;
+    }
+  } else {
+    uint32_t irq = ctx_base[reg_claim];
+    if (irq > 0 && irq < NR_SOURCE) {
+      in_service &= ~(1u << irq);
+      // the line is still asserted, so the gateway forwards it again
+      if (level & (1u << irq)) pending |= 1u << irq;
+    }
+  }
+  update_meip();
+}
+
+void init_plic() {
+  src_base = (uint32_t *)new_space(PLIC_SRC_SIZE);
+  ctx_base = (uint32_t *)new_space(PLIC_CTX_SIZE);
+  memset(src_base, 0, PLIC_SRC_SIZE);
+  memset(ctx_base, 0, PLIC_CTX_SIZE);
+  add_mmio_map("plic", CONFIG_PLIC_MMIO, src_base, PLIC_SRC_SIZE, plic_src_io_handler);
+  add_mmio_map("plic-context", CONFIG_PLIC_MMIO + PLIC_CONTEXT, ctx_base, PLIC_CTX_SIZE, plic_ctx_io_handler);
+}
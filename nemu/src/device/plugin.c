@@ -0,0 +1,137 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <device/map.h>
+#include <device/mmio.h>
+#include <device/event.h>
+#include <device/intr.h>
+#include <device/plugin.h>
+#include <memory/paddr.h>
+#include <dlfcn.h>
+#include <stdarg.h>
+
+// Device plugins are shared objects given by `--plugin=PATH[,ARGS]`.
+// Their MMIO ranges are maps with a bulk callback, see add_mmio_map_bulk().
+
+#define MAX_PLUGIN 16
+
+static const char *plugin_spec[MAX_PLUGIN] = {};
+static int nr_plugin = 0;
+
+void add_plugin(const char *spec) {
+  Assert(nr_plugin < MAX_PLUGIN, "Too many plugins");
+  plugin_spec[nr_plugin ++] = spec;
+}
+
+static int plugin_add_mmio(const char *name, uint64_t addr, uint32_t len,
+    nemu_mmio_fn fn, void *opaque) {
+  if (len == 0 || fn == NULL || addr + len - 1 > (paddr_t)-1 || mmio_map_full()) return -1;
+  // overlapped ranges are reported by the map itself
+  add_mmio_map_bulk(strdup(name), addr, len, fn, opaque);
+  return 0;
+}
+
+static int plugin_event_register(const char *name, int clock, void (*handler)()) {
+  if (clock < 0 || clock >= NR_EVENT_CLOCK || handler == NULL) return -1;
+  return event_register(strdup(name), clock, handler);
+}
+
+static int plugin_event_schedule(int id, uint64_t when, uint64_t period) {
+  if (!event_valid(id)) return -1;
+  event_schedule(id, when, period);
+  return 0;
+}
+
+static int plugin_event_cancel(int id) {
+  if (!event_valid(id)) return -1;
+  event_cancel(id);
+  return 0;
+}
+
+static int plugin_set_irq(int irq, bool level) {
+  if (irq <= 0 || irq >= NR_IRQ) return -1;
+  dev_set_irq(irq, level);
+  return 0;
+}
+
+static int plugin_dma(uint64_t addr, void *buf, uint32_t len, bool is_write) {
+  if (len == 0) return 0;
+  if (addr + len - 1 < addr || addr + len - 1 > (paddr_t)-1) return -1;
+  if (in_pmem(addr) && in_pmem(addr + len - 1)) {
+    if (is_write) {
+      memcpy(guest_to_host(addr), buf, len);
+      IFDEF(CONFIG_DIFFTEST, ref_difftest_memcpy(addr, buf, len, DIFFTEST_TO_REF));
+    } else {
+      memcpy(buf, guest_to_host(addr), len);
+    }
+    return 0;
+  }
+  if (in_pmem(addr) || in_pmem(addr + len - 1)) return -1;
+  return mmio_bulk_access(addr, buf, len, is_write) ? 0 : -1;
+}
+
+static int plugin_dma_read(uint64_t addr, void *buf, uint32_t len) {
+  return plugin_dma(addr, buf, len, false);
+}
+
+static int plugin_dma_write(uint64_t addr, const void *buf, uint32_t len) {
+  return plugin_dma(addr, (void *)buf, len, true);
+}
+
+static void plugin_log(const char *fmt, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  Log("%s", buf);
+}
+
+static const NEMUPluginAPI api = {
+  .version = NEMU_PLUGIN_VERSION,
+  .add_mmio = plugin_add_mmio,
+  .event_register = plugin_event_register,
+  .event_schedule = plugin_event_schedule,
+  .event_cancel = plugin_event_cancel,
+  .event_now = event_now,
+  .set_irq = plugin_set_irq,
+  .dma_read = plugin_dma_read,
+  .dma_write = plugin_dma_write,
+  .log = plugin_log,
+};
+
+static void load_plugin(const char *spec) {
+  char *path = strdup(spec);
+  char *args = strchr(path, ',');
+  if (args != NULL) *args ++ = '\0';
+  else args = path + strlen(path);
+
+  void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  Assert(handle, "Can not load plugin '%s': %s", path, dlerror());
+  nemu_plugin_init_fn init = (nemu_plugin_init_fn)dlsym(handle, NEMU_PLUGIN_INIT);
+  Assert(init, "Plugin '%s' does not export " NEMU_PLUGIN_INIT "()", path);
+  Log("Load plugin '%s' with arguments '%s'", path, args);
+  int ret = init(&api, args);
+  Assert(ret == 0, "Plugin '%s' fails to initialize (%d)", path, ret);
+  free(path);
+}
+
+void init_plugins() {
+  int i;
+  for (i = 0; i < nr_plugin; i ++) {
+    load_plugin(plugin_spec[i]);
+  }
+}
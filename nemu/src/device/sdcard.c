@@ -14,6 +14,11 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "mmc.h"
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
@@ -28,8 +33,14 @@
 #define C_SIZE (NR_BLOCK / MULT - 1)
 
 // This is a simple hardware implementation of linux/drivers/mmc/host/bcm2835.c
-// No DMA and IRQ is supported, so the driver must be modified to start PIO
+// No IRQ is supported, so the driver must be modified to start PIO
 // right after sending the actual read/write commands.
+//
+// The image is mapped into the address space of NEMU, and SDDATA accesses
+// are served from a cursor into the mapping set up by the read/write command.
+// With CONFIG_SDCARD_DMA, the NEMU-specific registers SDDMAADDR and SDDMACNT
+// let the driver transfer a whole multi-block request to/from guest memory
+// with a single memcpy() when the command is issued, bypassing SDDATA.
 
 enum {
   SDCMD, SDARG, SDTOUT, SDCDIV,
@@ -37,22 +48,56 @@ enum {
   SDHSTS, __PAD0, __PAD1, __PAD2,
   SDVDD, SDEDM, SDHCFG, SDHBCT,
   SDDATA, __PAD10, __PAD11, __PAD12,
-  SDHBLC
+  SDHBLC,
+  SDDMAADDR,  // guest physical address of the DMA buffer
+  SDDMACNT,   // number of blocks to transfer by DMA, 0 for PIO
 };
 
-static FILE *fp = NULL;
+static uint8_t *img = NULL;
+static size_t img_size = 0;
 static uint32_t *base = NULL;
 static uint32_t blkcnt = 0;
-static long blk_addr = 0;
+static uint64_t blk_offset = 0;
 static uint32_t addr = 0;
 static bool write_cmd = 0;
 static bool read_ext_csd = false;
 
+#ifdef CONFIG_SDCARD_DMA
+static void sdcard_dma() {
+  paddr_t buf = base[SDDMAADDR];
+  uint64_t len = (uint64_t)base[SDDMACNT] << 9;
+  base[SDDMACNT] = 0;
+  if (img == NULL) return;
+
+  Assert(blk_offset <= img_size && len <= img_size - blk_offset, "sdcard access [%" PRIu64 ", %" PRIu64 ") "
+      "is out of bound [0, %zu)", blk_offset, blk_offset + len, img_size);
+  Assert(buf - CONFIG_MBASE < CONFIG_MSIZE && len <= CONFIG_MSIZE - (buf - CONFIG_MBASE),
+      "sdcard DMA buffer [" FMT_PADDR ", 0x%" PRIx64 ") is out of bound of pmem", buf, buf + len);
+
+  if (write_cmd) { memcpy(img + blk_offset, guest_to_host(buf), len); }
+  else {
+    memcpy(guest_to_host(buf), img + blk_offset, len);
+    // the REF can not see this DMA, so bring the data to it as well
+    IFDEF(CONFIG_DIFFTEST, ref_difftest_memcpy(buf, guest_to_host(buf), len, DIFFTEST_TO_REF));
+  }
+}
+#endif
+
 static void prepare_rw(int is_write) {
-  blk_addr = base[SDARG];
+  blk_offset = (uint64_t)base[SDARG] << 9;
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
   write_cmd = is_write;
+  IFDEF(CONFIG_SDCARD_DMA, if (base[SDDMACNT] != 0) sdcard_dma());
+}
+
+static void sdcard_data(bool is_write) {
+  uint64_t off = blk_offset + addr;
+  if (off + 4 > img_size) {
+    if (!is_write) base[SDDATA] = 0;
+    return;
+  }
+  if (is_write) { memcpy(img + off, &base[SDDATA], 4); }
+  else { memcpy(&base[SDDATA], img + off, 4); }
 }
 
 static void sdcard_handle_cmd(int cmd) {
@@ -109,13 +154,16 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
          }
          base[SDDATA] = data;
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
+       } else if (img) {
+         sdcard_data(write_cmd);
        }
        addr += 4;
        break;
+#ifdef CONFIG_SDCARD_DMA
+    case SDDMAADDR:
+    case SDDMACNT:
+      break;
+#endif
     default:
       Log("offset = 0x%x(idx = %d), is_write = %d, data = 0x%x", offset, idx, is_write, base[idx]);
       panic("unhandle offset = %d", offset);
@@ -128,7 +176,17 @@ void init_sdcard() {
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
-  const char *img = CONFIG_SDCARD_IMG_PATH;
-  fp = fopen(img, "r+");
-  if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  const char *path = CONFIG_SDCARD_IMG_PATH;
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    Log("Can not find sdcard image: %s", path);
+    return;
+  }
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  img_size = st.st_size;
+  img = (uint8_t *)mmap(NULL, img_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Assert(img != MAP_FAILED, "Can not map sdcard image: %s", path);
+  close(fd);
 }
@@ -15,6 +15,7 @@
 
 #include <device/map.h>
 #include <device/alarm.h>
+#include <device/event.h>
 #include <utils.h>
 
 static uint32_t *rtc_port_base = NULL;
@@ -28,7 +29,8 @@ static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
   }
 }
 
-#ifndef CONFIG_TARGET_AM
+// with CLINT, the timer interrupt is raised by mtimecmp instead
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_HAS_CLINT)
 static void timer_intr() {
   if (nemu_state.state == NEMU_RUNNING) {
     extern void dev_raise_intr();
@@ -44,5 +46,8 @@ void init_timer() {
 #else
   add_mmio_map("rtc", CONFIG_RTC_MMIO, rtc_port_base, 8, rtc_io_handler);
 #endif
-  IFNDEF(CONFIG_TARGET_AM, add_alarm_handle(timer_intr));
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_HAS_CLINT)
+  int id = event_register("timer", EVENT_HOST, timer_intr);
+  event_schedule(id, get_time() + 1000000 / TIMER_HZ, 1000000 / TIMER_HZ);
+#endif
 }
@@ -15,6 +15,7 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <memory/paddr.h>
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -34,14 +35,233 @@ static uint32_t screen_size() {
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
-#ifdef CONFIG_VGA_SHOW_SCREEN
+// Writes to vmem are tracked at row granularity. Rows written since the
+// last refresh are flagged in `dirty_row`, and [dirty_lo, dirty_hi] bounds
+// them, so that a refresh only scans and uploads the rows which changed.
+static uint32_t row_bytes = 0;
+static uint32_t nr_row = 0;
+static bool *dirty_row = NULL;
+static uint32_t dirty_lo = 0, dirty_hi = 0;
+static bool is_dirty = false;
+
+static void mark_dirty(uint32_t y1, uint32_t y2) {
+  if (!is_dirty) { dirty_lo = y1; dirty_hi = y2; is_dirty = true; }
+  else {
+    if (y1 < dirty_lo) dirty_lo = y1;
+    if (y2 > dirty_hi) dirty_hi = y2;
+  }
+  for (uint32_t y = y1; y <= y2; y ++) dirty_row[y] = true;
+}
+
+static void clear_dirty() {
+  memset(dirty_row + dirty_lo, 0, dirty_hi - dirty_lo + 1);
+  is_dirty = false;
+}
+
+static void vmem_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write) {
+    mark_dirty(offset / row_bytes, (offset + len - 1) / row_bytes);
+  }
+}
+
+#if defined(CONFIG_VGA_SHOW_SCREEN) || defined(CONFIG_VGA_HEADLESS)
+#define VGA_OUTPUT 1
+#endif
+
+#ifdef CONFIG_VGA_HEADLESS
+#include <utils.h>
+
+static uint64_t frame_hash(const uint64_t *p, size_t n) {
+  // FNV-1a over 64-bit words
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < n; i ++) {
+    h = (h ^ p[i]) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+#ifdef CONFIG_VGA_HEADLESS_SHM
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Layout of the shared memory object: a header followed by two frame
+// buffers. A viewer maps the object read-only and displays buffer `front`.
+// `seq` is odd while a frame is being published, so a viewer can detect a
+// torn read by checking that `seq` is even and unchanged around its copy.
+typedef struct {
+  uint32_t magic;
+  uint32_t width, height;
+  uint32_t front;
+  uint64_t seq;
+  uint64_t frame;
+  uint64_t hash;
+} ShmHeader;
+
+#define SHM_MAGIC 0x554d454e // "NEMU"
+
+static ShmHeader *shm = NULL;
+static uint8_t *shm_buf[2] = {};
+
+static void init_screen() {
+  const char *name = CONFIG_VGA_HEADLESS_PATH;
+  size_t size = sizeof(ShmHeader) + 2 * screen_size();
+  int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+  Assert(fd >= 0, "Can not open shared memory object '%s'", name);
+  int ret = ftruncate(fd, size);
+  Assert(ret == 0, "Can not resize shared memory object '%s'", name);
+  shm = (ShmHeader *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Assert(shm != MAP_FAILED, "Can not map shared memory object '%s'", name);
+  close(fd);
+
+  shm_buf[0] = (uint8_t *)(shm + 1);
+  shm_buf[1] = shm_buf[0] + screen_size();
+  *shm = (ShmHeader) { .magic = SHM_MAGIC,
+    .width = screen_width(), .height = screen_height() };
+  Log("Export VGA frames to shared memory object '%s'", name);
+}
+
+static void export_frame(uint64_t hash) {
+  uint32_t back = !shm->front;
+  // seqlock: an odd seq must be visible before any write to the frame
+  __atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(shm_buf[back], vmem, screen_size());
+  shm->front = back;
+  shm->frame ++;
+  shm->hash = hash;
+  __atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+}
+#else // CONFIG_VGA_HEADLESS_PPM
+static FILE *ppm_fp = NULL;
+static uint8_t *ppm_buf = NULL;
+
+static void init_screen() {
+  const char *path = CONFIG_VGA_HEADLESS_PATH;
+  ppm_fp = fopen(path, "wb");
+  Assert(ppm_fp, "Can not open '%s'", path);
+  ppm_buf = (uint8_t *)malloc(screen_width() * screen_height() * 3);
+  assert(ppm_buf);
+  Log("Export VGA frames as a PPM stream to '%s'", path);
+}
+
+static void export_frame(uint64_t hash) {
+  uint32_t *src = (uint32_t *)vmem;
+  uint32_t nr_pixel = screen_width() * screen_height();
+  uint8_t *p = ppm_buf;
+  for (uint32_t i = 0; i < nr_pixel; i ++) {
+    uint32_t c = src[i];
+    *p ++ = c >> 16; *p ++ = c >> 8; *p ++ = c;
+  }
+  fprintf(ppm_fp, "P6\n%d %d\n255\n", screen_width(), screen_height());
+  fwrite(ppm_buf, 3, nr_pixel, ppm_fp);
+  fflush(ppm_fp);
+}
+#endif
+
+// Export the whole frame when vmem has changed since the last exported
+// frame. Frames are dropped (but stay dirty) if they come faster than
+// CONFIG_VGA_HEADLESS_FPS.
+static inline void update_screen() {
+  static uint64_t nr_frame = 0;
+  if (!is_dirty) return;
+#if CONFIG_VGA_HEADLESS_FPS > 0
+  static uint64_t last = 0;
+  uint64_t now = get_time();
+  if (nr_frame > 0 && now - last < 1000000 / CONFIG_VGA_HEADLESS_FPS) return;
+  last = now;
+#endif
+  uint64_t hash = frame_hash((uint64_t *)vmem, screen_size() / sizeof(uint64_t));
+  export_frame(hash);
+  log_write("vga: frame %" PRIu64 ", hash = 0x%016" PRIx64 "\n", nr_frame, hash);
+  nr_frame ++;
+  clear_dirty();
+}
+#elif defined(CONFIG_VGA_SHOW_SCREEN)
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <device/alarm.h>
+
+// SDL is owned by a display thread, so that rendering and waiting for vsync
+// or the window manager never stall the guest. The emulation thread copies
+// vmem into one of three frame buffers and publishes it in `mailbox` with
+// an atomic exchange. The display thread takes the latest published frame
+// and uploads the band of rows which changed since the last frame it saw.
+// Frames published in between are dropped, and their bands are merged.
+
+#define NR_FRAME 3
+#define MB_IDX(m)  ((m) & 0x3)
+#define MB_FRESH   0x4ull
+#define MB_LO(m)   ((uint32_t)((m) >> 8) & 0xffffff)
+#define MB_HI(m)   ((uint32_t)((m) >> 32) & 0xffffff)
+#define MB(idx, lo, hi) ((idx) | MB_FRESH | ((uint64_t)(lo) << 8) | ((uint64_t)(hi) << 32))
+
+typedef struct { uint32_t lo, hi; } Band; // empty if lo > hi
+#define EMPTY_BAND ((Band) { .lo = 1, .hi = 0 })
+
+static uint8_t *frame[NR_FRAME] = {};
+static uint64_t mailbox = 1; // frame 1 is published first, and not fresh
+static int back = 0;         // written by the emulation thread
+static int front = 2;        // read by the display thread
+// rows published since each frame was written, only used by the emulation thread
+static Band stale[NR_FRAME] = {};
+static bool display_ready = false;
 
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
 
-static void init_screen() {
+static Band band_union(Band a, Band b) {
+  if (a.lo > a.hi) return b;
+  if (b.lo > b.hi) return a;
+  return (Band) { .lo = (a.lo < b.lo ? a.lo : b.lo), .hi = (a.hi > b.hi ? a.hi : b.hi) };
+}
+
+// upload rows [y, y + h) of the front frame into the streaming texture
+static void update_rect(int y, int h) {
+  SDL_Rect rect = { .x = 0, .y = y, .w = SCREEN_W, .h = h };
+  void *pixels;
+  int pitch;
+  if (SDL_LockTexture(texture, &rect, &pixels, &pitch) != 0) return;
+  uint8_t *src = frame[front] + y * row_bytes;
+  if ((uint32_t)pitch == row_bytes) { memcpy(pixels, src, h * row_bytes); }
+  else {
+    for (int i = 0; i < h; i ++) {
+      memcpy((uint8_t *)pixels + i * pitch, src + i * row_bytes, row_bytes);
+    }
+  }
+  SDL_UnlockTexture(texture);
+}
+
+static void display_frame() {
+  uint64_t m = __atomic_load_n(&mailbox, __ATOMIC_ACQUIRE);
+  if (!(m & MB_FRESH)) return;
+  // only the emulation thread can change `mailbox` meanwhile, and it keeps it fresh
+  m = __atomic_exchange_n(&mailbox, (uint64_t)front, __ATOMIC_ACQ_REL);
+  front = MB_IDX(m);
+  update_rect(MB_LO(m), MB_HI(m) - MB_LO(m) + 1);
+  SDL_RenderClear(renderer);
+  SDL_RenderCopy(renderer, texture, NULL, NULL);
+  SDL_RenderPresent(renderer);
+}
+
+static void handle_event(SDL_Event *event) {
+  extern void sdl_request_quit();
+  extern void send_key(uint8_t, bool);
+  switch (event->type) {
+    case SDL_QUIT: sdl_request_quit(); break;
+#ifdef CONFIG_HAS_KEYBOARD
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+      send_key(event->key.keysym.scancode, event->key.type == SDL_KEYDOWN);
+      break;
+#endif
+    default: break;
+  }
+}
+
+static void* display_thread(void *arg) {
   SDL_Window *window = NULL;
   char title[128];
   sprintf(title, "%s-NEMU", str(__GUEST_ISA__));
@@ -52,41 +272,296 @@ static void init_screen() {
       0, &window, &renderer);
   SDL_SetWindowTitle(window, title);
   texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-      SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
+      SDL_TEXTUREACCESS_STREAMING, SCREEN_W, SCREEN_H);
   SDL_RenderPresent(renderer);
+  __atomic_store_n(&display_ready, true, __ATOMIC_RELEASE);
+
+  while (true) {
+    SDL_Event event;
+    if (SDL_WaitEventTimeout(&event, 1000 / TIMER_HZ)) {
+      do { handle_event(&event); } while (SDL_PollEvent(&event));
+    }
+    display_frame();
+  }
+  return NULL;
+}
+
+static void init_screen() {
+  for (int i = 0; i < NR_FRAME; i ++) {
+    frame[i] = (uint8_t *)calloc(1, screen_size());
+    assert(frame[i]);
+    stale[i] = EMPTY_BAND;
+  }
+  pthread_t thread;
+  int ret = pthread_create(&thread, NULL, display_thread, NULL);
+  Assert(ret == 0, "Can not create display thread");
+  pthread_detach(thread);
+  // other devices (e.g. audio) may initialize SDL subsystems later
+  while (!__atomic_load_n(&display_ready, __ATOMIC_ACQUIRE)) usleep(1000);
 }
 
+// Bring the back frame up to date by copying the rows changed since it was
+// last written, then publish it. Nothing is published if vmem is untouched.
 static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
-  SDL_RenderClear(renderer);
-  SDL_RenderCopy(renderer, texture, NULL, NULL);
-  SDL_RenderPresent(renderer);
+  if (!is_dirty) return;
+  Band b = { .lo = dirty_lo, .hi = dirty_hi };
+  Band c = band_union(stale[back], b);
+  memcpy(frame[back] + c.lo * row_bytes, (uint8_t *)vmem + c.lo * row_bytes,
+      (c.hi - c.lo + 1) * row_bytes);
+  for (int i = 0; i < NR_FRAME; i ++) {
+    stale[i] = (i == back ? EMPTY_BAND : band_union(stale[i], b));
+  }
+
+  uint64_t old = __atomic_load_n(&mailbox, __ATOMIC_RELAXED), m;
+  do {
+    // the frame in the mailbox is dropped if it was never displayed
+    Band p = b;
+    if (old & MB_FRESH) p = band_union(p, (Band) { .lo = MB_LO(old), .hi = MB_HI(old) });
+    m = MB((uint64_t)back, p.lo, p.hi);
+  } while (!__atomic_compare_exchange_n(&mailbox, &old, m, false,
+        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+  back = MB_IDX(old);
+  clear_dirty();
 }
 #else
 static void init_screen() {}
 
+static inline void update_rect(int y, int h) {
+  io_write(AM_GPU_FBDRAW, 0, y, (uint8_t *)vmem + y * row_bytes, screen_width(), h, false);
+}
+
+static inline void present_screen() {
+  io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
+}
+
+// Upload each band of consecutive dirty rows as one rectangle.
+// Nothing is uploaded or presented if vmem is untouched since the last frame.
 static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+  if (!is_dirty) return;
+  uint32_t y = dirty_lo;
+  while (y <= dirty_hi) {
+    if (!dirty_row[y]) { y ++; continue; }
+    uint32_t start = y;
+    while (y <= dirty_hi && dirty_row[y]) y ++;
+    update_rect(start, y - start);
+  }
+  clear_dirty();
+  present_screen();
 }
 #endif
 #endif
 
+// 2D acceleration. The guest sets up the operands and writes the command
+// register, then the command is executed on vmem at host memory bandwidth.
+// Rectangles are clipped to the screen. Pixels are ARGB8888, and blending
+// uses the alpha of the source pixels.
+
+enum { reg_size, reg_sync, reg_cmd, reg_x, reg_y, reg_w, reg_h,
+  reg_src_x, reg_src_y, reg_src, reg_color, nr_vgactl_reg };
+enum { CMD_NONE, CMD_FILL, CMD_COPY, CMD_BLIT, CMD_BLEND };
+
+// dst = (src * a + dst * (255 - a)) / 255 for each channel, rounded
+static inline uint32_t div255(uint32_t x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+static void fill_row_scalar(uint32_t *dst, int n, uint32_t color) {
+  for (int i = 0; i < n; i ++) dst[i] = color;
+}
+
+static void blend_row_scalar(uint32_t *dst, const uint32_t *src, int n) {
+  for (int i = 0; i < n; i ++) {
+    uint32_t s = src[i], d = dst[i], a = s >> 24, c = 0;
+    for (int sh = 0; sh < 32; sh += 8) {
+      c |= div255(((s >> sh) & 0xff) * a + ((d >> sh) & 0xff) * (255 - a)) << sh;
+    }
+    dst[i] = c;
+  }
+}
+
+#if defined(__x86_64__) && !defined(CONFIG_TARGET_AM)
+#include <immintrin.h>
+
+// SSE2 is always available on x86-64, and AVX2 is selected at runtime.
+// Channels are widened to 16 bits, where s * a + d * (255 - a) can not overflow.
+
+static void fill_row_sse2(uint32_t *dst, int n, uint32_t color) {
+  __m128i c = _mm_set1_epi32(color);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) _mm_storeu_si128((__m128i *)(dst + i), c);
+  fill_row_scalar(dst + i, n - i, color);
+}
+
+static inline __m128i blend_sse2(__m128i s, __m128i d) {
+  __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xff), 0xff);
+  __m128i x = _mm_add_epi16(_mm_mullo_epi16(s, a),
+      _mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255), a)));
+  x = _mm_add_epi16(x, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static void blend_row_sse2(uint32_t *dst, const uint32_t *src, int n) {
+  __m128i zero = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i lo = blend_sse2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+    __m128i hi = blend_sse2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+  }
+  blend_row_scalar(dst + i, src + i, n - i);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static void fill_row_avx2(uint32_t *dst, int n, uint32_t color) {
+  __m256i c = _mm256_set1_epi32(color);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) _mm256_storeu_si256((__m256i *)(dst + i), c);
+  fill_row_sse2(dst + i, n - i, color);
+}
+
+AVX2 static inline __m256i blend_avx2(__m256i s, __m256i d) {
+  __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xff), 0xff);
+  __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(s, a),
+      _mm256_mullo_epi16(d, _mm256_sub_epi16(_mm256_set1_epi16(255), a)));
+  x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+AVX2 static void blend_row_avx2(uint32_t *dst, const uint32_t *src, int n) {
+  __m256i zero = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    // unpacking and packing are both within 128-bit lanes, so the order is kept
+    __m256i lo = blend_avx2(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero));
+    __m256i hi = blend_avx2(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+  }
+  blend_row_sse2(dst + i, src + i, n - i);
+}
+
+static void (*fill_row)(uint32_t *, int, uint32_t) = fill_row_sse2;
+static void (*blend_row)(uint32_t *, const uint32_t *, int) = blend_row_sse2;
+
+static void init_accel() {
+  if (__builtin_cpu_supports("avx2")) {
+    fill_row = fill_row_avx2;
+    blend_row = blend_row_avx2;
+  }
+}
+#else
+#define fill_row fill_row_scalar
+#define blend_row blend_row_scalar
+static void init_accel() {}
+#endif
+
+// clip [x, x + w) to [0, max), and move the source position along;
+// the operands from the guest are 32-bit, so they can not overflow in 64 bits
+static bool clip(int64_t *x, int64_t *w, int64_t max, int64_t *sx) {
+  if (*x < 0) { *w += *x; *sx -= *x; *x = 0; }
+  if (*w > max - *x) *w = max - *x;
+  return *w > 0;
+}
+
+static void accel_cmd(uint32_t cmd) {
+  uint32_t *ctl = vgactl_port_base;
+  int64_t x = (int32_t)ctl[reg_x], y = (int32_t)ctl[reg_y];
+  int64_t w = (int32_t)ctl[reg_w], h = (int32_t)ctl[reg_h];
+  int64_t sx = (int32_t)ctl[reg_src_x], sy = (int32_t)ctl[reg_src_y];
+  // pixels of a blit source are packed, so keep its pitch before clipping
+  int64_t src_pitch = w;
+  if (cmd == CMD_COPY) {
+    // the source rectangle is in vmem too
+    if (!clip(&sx, &w, screen_width(), &x) || !clip(&sy, &h, screen_height(), &y)) return;
+  }
+  if (!clip(&x, &w, screen_width(), &sx) || !clip(&y, &h, screen_height(), &sy)) return;
+  uint32_t *fb = (uint32_t *)vmem;
+  uint32_t pitch = screen_width();
+
+  switch (cmd) {
+    case CMD_FILL:
+      for (int i = 0; i < h; i ++) fill_row(fb + (y + i) * pitch + x, w, ctl[reg_color]);
+      break;
+    case CMD_COPY:
+      // the rectangles can overlap, so walk the rows away from the destination
+      if (y <= sy) {
+        for (int i = 0; i < h; i ++) {
+          memmove(fb + (y + i) * pitch + x, fb + (sy + i) * pitch + sx, w * sizeof(uint32_t));
+        }
+      } else {
+        for (int i = h - 1; i >= 0; i --) {
+          memmove(fb + (y + i) * pitch + x, fb + (sy + i) * pitch + sx, w * sizeof(uint32_t));
+        }
+      }
+      break;
+    case CMD_BLIT:
+    case CMD_BLEND: {
+      // in 64 bits, so that the operands from the guest can not wrap around
+      int64_t start = (int64_t)ctl[reg_src] - CONFIG_MBASE +
+        (sy * src_pitch + sx) * (int64_t)sizeof(uint32_t);
+      uint64_t size = ((uint64_t)(h - 1) * src_pitch + w) * sizeof(uint32_t);
+      Assert(start >= 0 && (uint64_t)start <= CONFIG_MSIZE && size <= CONFIG_MSIZE - (uint64_t)start,
+          "vga blit source [0x%" PRIx64 ", 0x%" PRIx64 ") is out of bound",
+          CONFIG_MBASE + start, CONFIG_MBASE + start + size);
+      uint32_t *s = (uint32_t *)(guest_to_host(CONFIG_MBASE) + start);
+      for (int i = 0; i < h; i ++) {
+        uint32_t *d = fb + (y + i) * pitch + x;
+        if (cmd == CMD_BLIT) memcpy(d, s + i * src_pitch, w * sizeof(uint32_t));
+        else blend_row(d, s + i * src_pitch, w);
+      }
+      break;
+    }
+    default: Log("vga: unknown accel command %d", cmd); return;
+  }
+  mark_dirty(y, y + h - 1);
+}
+
+static void vgactl_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write && offset == reg_w * sizeof(uint32_t)) {
+    // the width is also the pitch of a blit source, which must fit in pmem
+    if (vgactl_port_base[reg_w] > CONFIG_MSIZE / sizeof(uint32_t)) {
+      Log("vga: invalid width %d", (int32_t)vgactl_port_base[reg_w]);
+      vgactl_port_base[reg_w] = 0;
+    }
+  }
+  if (is_write && offset == reg_cmd * sizeof(uint32_t)) {
+    accel_cmd(vgactl_port_base[reg_cmd]);
+    vgactl_port_base[reg_cmd] = CMD_NONE;
+  }
+}
+
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  if (vgactl_port_base[reg_sync] != 0) {
+    IFDEF(VGA_OUTPUT, update_screen());
+    vgactl_port_base[reg_sync] = 0;
+  }
 }
 
 void init_vga() {
-  vgactl_port_base = (uint32_t *)new_space(8);
-  vgactl_port_base[0] = (screen_width() << 16) | screen_height();
+  uint32_t space_size = sizeof(uint32_t) * nr_vgactl_reg;
+  vgactl_port_base = (uint32_t *)new_space(space_size);
+  memset(vgactl_port_base, 0, space_size);
+  vgactl_port_base[reg_size] = (screen_width() << 16) | screen_height();
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, space_size, vgactl_io_handler);
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, space_size, vgactl_io_handler);
 #endif
+  init_accel();
+
+  row_bytes = screen_width() * sizeof(uint32_t);
+  nr_row = screen_height();
+  dirty_row = (bool *)calloc(nr_row, sizeof(bool));
+  assert(dirty_row);
+  mark_dirty(0, nr_row - 1);
 
   vmem = new_space(screen_size());
-  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), vmem_io_handler);
+  IFDEF(VGA_OUTPUT, init_screen());
+  IFDEF(VGA_OUTPUT, memset(vmem, 0, screen_size()));
 }
@@ -0,0 +1,142 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "virtio.h"
+
+// A write to QueueNotify processes all requests in the available ring,
+// and the driver is notified once for the whole batch. Each data buffer
+// is copied between the mapped image and guest memory by one memcpy().
+
+#define SECTOR_SIZE 512
+
+#define VIRTIO_BLK_F_SEG_MAX 2
+#define VIRTIO_BLK_F_FLUSH   9
+
+enum { VIRTIO_BLK_T_IN = 0, VIRTIO_BLK_T_OUT = 1, VIRTIO_BLK_T_FLUSH = 4, VIRTIO_BLK_T_GET_ID = 8 };
+enum { VIRTIO_BLK_S_OK = 0, VIRTIO_BLK_S_IOERR = 1, VIRTIO_BLK_S_UNSUPP = 2 };
+
+typedef struct {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+} BlkReqHdr;
+
+typedef struct {
+  uint64_t capacity;
+  uint32_t size_max;
+  uint32_t seg_max;
+} BlkConfig;
+
+static VirtIODev blk = {
+  .name = "virtio-blk",
+  .device_id = VIRTIO_ID_BLOCK,
+  .irq = CONFIG_VIRTIO_BLK_IRQ,
+  .features = (1ull << VIRTIO_BLK_F_SEG_MAX) | (1ull << VIRTIO_BLK_F_FLUSH),
+  .nr_queue = 1,
+};
+static uint8_t *img = NULL;
+static size_t img_size = 0;
+
+static uint8_t blk_handle(VirtQElem *elem, uint32_t *written) {
+  Assert(elem->nr_seg >= 2 && elem->seg[0].len >= sizeof(BlkReqHdr) && !elem->seg[0].is_write,
+      "virtio-blk: malformed request");
+  BlkReqHdr *hdr = (BlkReqHdr *)elem->seg[0].buf;
+  uint64_t offset;
+  int i;
+
+  switch (hdr->type) {
+    case VIRTIO_BLK_T_IN:
+    case VIRTIO_BLK_T_OUT:
+      // checked by subtraction, since the sector from the guest can be anything
+      if (hdr->sector > img_size / SECTOR_SIZE) return VIRTIO_BLK_S_IOERR;
+      offset = hdr->sector * SECTOR_SIZE;
+      for (i = 1; i < elem->nr_seg - 1; i ++) {
+        VirtIOSeg *s = &elem->seg[i];
+        // the device writes the buffers of a read, and only reads those of a write
+        if (s->is_write != (hdr->type == VIRTIO_BLK_T_IN)) return VIRTIO_BLK_S_IOERR;
+        if (s->len > img_size - offset) return VIRTIO_BLK_S_IOERR;
+        if (hdr->type == VIRTIO_BLK_T_IN) {
+          memcpy(s->buf, img + offset, s->len);
+          *written += s->len;
+        } else {
+          memcpy(img + offset, s->buf, s->len);
+        }
+        offset += s->len;
+      }
+      return VIRTIO_BLK_S_OK;
+    case VIRTIO_BLK_T_FLUSH:
+      if (img) msync(img, img_size, MS_SYNC);
+      return VIRTIO_BLK_S_OK;
+    case VIRTIO_BLK_T_GET_ID:
+      if (elem->nr_seg == 3) {
+        VirtIOSeg *s = &elem->seg[1];
+        strncpy((char *)s->buf, "nemu-virtio-blk", s->len);
+        *written += s->len;
+      }
+      return VIRTIO_BLK_S_OK;
+    default: return VIRTIO_BLK_S_UNSUPP;
+  }
+}
+
+static void blk_notify(VirtIODev *dev, int q) {
+  static VirtQElem elem;
+  bool done = false;
+  while (virtq_pop(dev, q, &elem)) {
+    VirtIOSeg *status = &elem.seg[elem.nr_seg - 1];
+    Assert(status->is_write && status->len >= 1, "virtio-blk: no status byte");
+    uint32_t written = 1;
+    *status->buf = blk_handle(&elem, &written);
+    virtq_push(dev, q, &elem, written);
+    done = true;
+  }
+  if (done) virtio_notify(dev, q);
+}
+
+static void blk_io_handler(uint32_t offset, int len, bool is_write) {
+  virtio_mmio_access(&blk, offset, len, is_write);
+}
+
+static void init_img(const char *path) {
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    Log("Can not open virtio-blk image: %s", path);
+    return;
+  }
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  img_size = st.st_size;
+  img = (uint8_t *)mmap(NULL, img_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Assert(img != MAP_FAILED, "Can not map virtio-blk image: %s", path);
+  close(fd);
+  Log("virtio-blk image %s, size = %zu", path, img_size);
+}
+
+void init_virtio_blk() {
+  blk.notify = blk_notify;
+  virtio_init(&blk, CONFIG_VIRTIO_BLK_MMIO, blk_io_handler);
+
+  const char *path = CONFIG_VIRTIO_BLK_IMG_PATH;
+  if (path[0] != '\0') init_img(path);
+
+  BlkConfig *cfg = (BlkConfig *)virtio_config(&blk);
+  cfg->capacity = img_size / SECTOR_SIZE;
+  cfg->size_max = 0;
+  cfg->seg_max = VIRTQ_MAX_SIZE - 2;
+}
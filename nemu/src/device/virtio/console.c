@@ -0,0 +1,185 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for posix_openpt() and friends
+#endif
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <device/alarm.h>
+#include <device/event.h>
+#include "virtio.h"
+
+// A single port console without any features. The buffers in the transmit
+// queue are written to the host backend as a whole on QueueNotify, and
+// host input is copied into the buffers of the receive queue once the
+// backend becomes readable. The backend is a pseudo terminal or a UNIX
+// socket, and output is dropped if nobody is reading it.
+
+enum { RX_QUEUE, TX_QUEUE };
+
+static VirtIODev console = {
+  .name = "virtio-console",
+  .device_id = VIRTIO_ID_CONSOLE,
+  .irq = CONFIG_VIRTIO_CONSOLE_IRQ,
+  .nr_queue = 2,
+};
+static int fd = -1;
+IFDEF(CONFIG_VIRTIO_CONSOLE_SOCKET, static int listen_fd = -1);
+IFDEF(CONFIG_VIRTIO_CONSOLE_PTY, static int hup_event = -1);
+static int rx_watch = -1;
+// false while the input waits for buffers of the receive queue
+static bool rx_watching = false;
+
+#ifdef CONFIG_VIRTIO_CONSOLE_SOCKET
+static void backend_close() {
+  if (fd < 0) return;
+  // wait for the next connection
+  alarm_change_fd(rx_watch, listen_fd);
+  close(fd);
+  fd = -1;
+}
+
+static void backend_hangup() {
+  backend_close();
+}
+#else
+static void backend_close() {}
+
+// the master keeps reporting a hangup until a terminal opens the slave again
+static void backend_hangup() {
+  event_schedule(hup_event, event_now(EVENT_HOST) + 1000000 / TIMER_HZ, 0);
+}
+
+static void hup_rearm() {
+  alarm_rearm_fd(rx_watch);
+}
+#endif
+
+static void console_tx(VirtIODev *dev, int q) {
+  static VirtQElem elem;
+  bool done = false;
+  while (virtq_pop(dev, q, &elem)) {
+    int i;
+    for (i = 0; i < elem.nr_seg; i ++) {
+      VirtIOSeg *s = &elem.seg[i];
+      uint32_t n = 0;
+      while (fd >= 0 && n < s->len) {
+        ssize_t ret = MUXDEF(CONFIG_VIRTIO_CONSOLE_SOCKET,
+            send(fd, s->buf + n, s->len - n, MSG_NOSIGNAL), write(fd, s->buf + n, s->len - n));
+        if (ret > 0) { n += ret; continue; }
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0 && errno != EAGAIN) backend_close();
+        break;
+      }
+    }
+    virtq_push(dev, q, &elem, 0);
+    done = true;
+  }
+  if (done) virtio_notify(dev, q);
+}
+
+static void console_rx() {
+  static uint8_t rx_buf[4096];
+  static int rx_pos = 0, rx_len = 0;
+  static VirtQElem elem;
+
+  rx_watching = true;
+#ifdef CONFIG_VIRTIO_CONSOLE_SOCKET
+  if (fd < 0) {
+    fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) { alarm_rearm_fd(rx_watch); return; }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    alarm_change_fd(rx_watch, fd);
+  }
+#endif
+  if (!virtio_ready(&console, RX_QUEUE)) { rx_watching = false; return; }
+
+  bool done = false;
+  while (true) {
+    if (rx_pos == rx_len) {
+      ssize_t ret = read(fd, rx_buf, sizeof(rx_buf));
+      if (ret < 0 && errno == EINTR) continue;
+      if (ret < 0 && errno == EAGAIN) alarm_rearm_fd(rx_watch);
+      else if (ret <= 0) backend_hangup();
+      if (ret <= 0) break;
+      rx_pos = 0;
+      rx_len = ret;
+    }
+    // the input stays in the backend until the guest provides more buffers
+    if (!virtq_pop(&console, RX_QUEUE, &elem)) { rx_watching = false; break; }
+    uint32_t len = 0;
+    int i;
+    for (i = 0; i < elem.nr_seg && rx_pos < rx_len; i ++) {
+      VirtIOSeg *s = &elem.seg[i];
+      if (!s->is_write) continue;
+      uint32_t n = rx_len - rx_pos;
+      if (n > s->len) n = s->len;
+      memcpy(s->buf, rx_buf + rx_pos, n);
+      rx_pos += n;
+      len += n;
+    }
+    virtq_push(&console, RX_QUEUE, &elem, len);
+    done = true;
+  }
+  if (done) virtio_notify(&console, RX_QUEUE);
+}
+
+static void console_notify(VirtIODev *dev, int q) {
+  if (q == TX_QUEUE) console_tx(dev, q);
+  else if (!rx_watching) console_rx();
+}
+
+static void console_io_handler(uint32_t offset, int len, bool is_write) {
+  virtio_mmio_access(&console, offset, len, is_write);
+}
+
+#ifdef CONFIG_VIRTIO_CONSOLE_PTY
+static void init_backend() {
+  fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  Assert(fd >= 0, "Can not open pseudo terminal");
+  int ret = grantpt(fd);
+  ret |= unlockpt(fd);
+  Assert(ret == 0, "Can not unlock pseudo terminal");
+  Log("virtio-console is connected to %s", ptsname(fd));
+}
+#else
+static void init_backend() {
+  const char *path = CONFIG_VIRTIO_CONSOLE_SOCKET_PATH;
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  Assert(strlen(path) < sizeof(addr.sun_path), "socket path %s is too long", path);
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  Assert(listen_fd >= 0, "Can not create socket");
+  int ret = bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+  Assert(ret == 0, "Can not bind socket to %s", path);
+  ret = listen(listen_fd, 1);
+  assert(ret == 0);
+  Log("virtio-console is listening on %s", path);
+}
+#endif
+
+void init_virtio_console() {
+  console.notify = console_notify;
+  virtio_init(&console, CONFIG_VIRTIO_CONSOLE_MMIO, console_io_handler);
+  init_backend();
+  IFDEF(CONFIG_VIRTIO_CONSOLE_PTY, hup_event = event_register("virtio-console-hup", EVENT_HOST, hup_rearm));
+  rx_watch = add_alarm_fd(MUXDEF(CONFIG_VIRTIO_CONSOLE_SOCKET, listen_fd, fd), console_rx);
+  rx_watching = true;
+}
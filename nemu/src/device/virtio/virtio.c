@@ -0,0 +1,212 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <memory/paddr.h>
+#include <device/intr.h>
+#include "virtio.h"
+
+enum {
+  VIRTIO_MMIO_MAGIC_VALUE       = 0x000,
+  VIRTIO_MMIO_VERSION           = 0x004,
+  VIRTIO_MMIO_DEVICE_ID         = 0x008,
+  VIRTIO_MMIO_VENDOR_ID         = 0x00c,
+  VIRTIO_MMIO_DEVICE_FEATURES   = 0x010,
+  VIRTIO_MMIO_DEVICE_FEATURES_SEL = 0x014,
+  VIRTIO_MMIO_DRIVER_FEATURES   = 0x020,
+  VIRTIO_MMIO_DRIVER_FEATURES_SEL = 0x024,
+  VIRTIO_MMIO_QUEUE_SEL         = 0x030,
+  VIRTIO_MMIO_QUEUE_NUM_MAX     = 0x034,
+  VIRTIO_MMIO_QUEUE_NUM         = 0x038,
+  VIRTIO_MMIO_QUEUE_READY       = 0x044,
+  VIRTIO_MMIO_QUEUE_NOTIFY      = 0x050,
+  VIRTIO_MMIO_INTERRUPT_STATUS  = 0x060,
+  VIRTIO_MMIO_INTERRUPT_ACK     = 0x064,
+  VIRTIO_MMIO_STATUS            = 0x070,
+  VIRTIO_MMIO_QUEUE_DESC_LOW    = 0x080,
+  VIRTIO_MMIO_QUEUE_DESC_HIGH   = 0x084,
+  VIRTIO_MMIO_QUEUE_DRIVER_LOW  = 0x090,
+  VIRTIO_MMIO_QUEUE_DRIVER_HIGH = 0x094,
+  VIRTIO_MMIO_QUEUE_DEVICE_LOW  = 0x0a0,
+  VIRTIO_MMIO_QUEUE_DEVICE_HIGH = 0x0a4,
+  VIRTIO_MMIO_CONFIG_GENERATION = 0x0fc,
+};
+
+#define VIRTIO_MAGIC 0x74726976 // "virt"
+#define VIRTIO_VENDOR 0x554d454e // "NEMU"
+
+#define VIRTIO_STATUS_FEATURES_OK 0x8
+
+#define VIRTQ_DESC_F_NEXT  1
+#define VIRTQ_DESC_F_WRITE 2
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+
+#define VIRTIO_INT_VRING 1
+
+typedef struct {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+} VirtqDesc;
+
+// the rings are little-endian, which is also true for the host
+static void* vq_ptr(uint64_t addr, uint32_t len) {
+  Assert(addr - CONFIG_MBASE < CONFIG_MSIZE && len <= CONFIG_MSIZE - (addr - CONFIG_MBASE),
+      "virtqueue buffer [0x%" PRIx64 ", 0x%" PRIx64 ") is out of bound of pmem", addr, addr + len);
+  return guest_to_host(addr);
+}
+
+// the interrupt line is asserted until the driver acknowledges all causes
+static void update_irq(VirtIODev *dev) {
+  dev_set_irq(dev->irq, dev->isr != 0);
+}
+
+static void virtio_reset(VirtIODev *dev) {
+  dev->driver_features = 0;
+  dev->status = dev->isr = 0;
+  update_irq(dev);
+  dev->dev_feat_sel = dev->drv_feat_sel = dev->queue_sel = 0;
+  memset(dev->vq, 0, sizeof(dev->vq));
+  if (dev->reset) dev->reset(dev);
+}
+
+static void set_hi(uint64_t *p, uint32_t val) { *p = (*p & 0xffffffffu) | ((uint64_t)val << 32); }
+static void set_lo(uint64_t *p, uint32_t val) { *p = (*p & ~0xffffffffull) | val; }
+
+static uint32_t reg_read(VirtIODev *dev, uint32_t offset) {
+  VirtQueue *vq = (dev->queue_sel < (uint32_t)dev->nr_queue ? &dev->vq[dev->queue_sel] : NULL);
+  switch (offset) {
+    case VIRTIO_MMIO_MAGIC_VALUE: return VIRTIO_MAGIC;
+    case VIRTIO_MMIO_VERSION: return 2;
+    case VIRTIO_MMIO_DEVICE_ID: return dev->device_id;
+    case VIRTIO_MMIO_VENDOR_ID: return VIRTIO_VENDOR;
+    case VIRTIO_MMIO_DEVICE_FEATURES:
+      return (dev->dev_feat_sel < 2 ? dev->features >> (32 * dev->dev_feat_sel) : 0);
+    case VIRTIO_MMIO_QUEUE_NUM_MAX: return (vq ? VIRTQ_MAX_SIZE : 0);
+    case VIRTIO_MMIO_QUEUE_READY: return (vq ? vq->ready : 0);
+    case VIRTIO_MMIO_INTERRUPT_STATUS: return dev->isr;
+    case VIRTIO_MMIO_STATUS: return dev->status;
+    case VIRTIO_MMIO_CONFIG_GENERATION: return dev->config_generation;
+    default: return 0;
+  }
+}
+
+static void reg_write(VirtIODev *dev, uint32_t offset, uint32_t val) {
+  VirtQueue *vq = (dev->queue_sel < (uint32_t)dev->nr_queue ? &dev->vq[dev->queue_sel] : NULL);
+  switch (offset) {
+    case VIRTIO_MMIO_DEVICE_FEATURES_SEL: dev->dev_feat_sel = val; break;
+    case VIRTIO_MMIO_DRIVER_FEATURES:
+      if (dev->drv_feat_sel == 0) set_lo(&dev->driver_features, val);
+      else if (dev->drv_feat_sel == 1) set_hi(&dev->driver_features, val);
+      break;
+    case VIRTIO_MMIO_DRIVER_FEATURES_SEL: dev->drv_feat_sel = val; break;
+    case VIRTIO_MMIO_QUEUE_SEL: dev->queue_sel = val; break;
+    case VIRTIO_MMIO_QUEUE_NUM:
+      if (vq) {
+        Assert(val <= VIRTQ_MAX_SIZE, "%s: queue size %d is too large", dev->name, val);
+        vq->num = val;
+      }
+      break;
+    case VIRTIO_MMIO_QUEUE_READY: if (vq) { vq->ready = val & 1; } break;
+    case VIRTIO_MMIO_QUEUE_NOTIFY:
+      if (val < (uint32_t)dev->nr_queue && virtio_ready(dev, val)) dev->notify(dev, val);
+      break;
+    case VIRTIO_MMIO_INTERRUPT_ACK: dev->isr &= ~val; update_irq(dev); break;
+    case VIRTIO_MMIO_STATUS:
+      if (val == 0) { virtio_reset(dev); break; }
+      if ((val & VIRTIO_STATUS_FEATURES_OK) && !(dev->status & VIRTIO_STATUS_FEATURES_OK) &&
+          (dev->driver_features & ~dev->features)) {
+        val &= ~VIRTIO_STATUS_FEATURES_OK; // refuse unknown features
+      }
+      dev->status = val;
+      break;
+    case VIRTIO_MMIO_QUEUE_DESC_LOW:    if (vq) set_lo(&vq->desc, val);  break;
+    case VIRTIO_MMIO_QUEUE_DESC_HIGH:   if (vq) set_hi(&vq->desc, val);  break;
+    case VIRTIO_MMIO_QUEUE_DRIVER_LOW:  if (vq) set_lo(&vq->avail, val); break;
+    case VIRTIO_MMIO_QUEUE_DRIVER_HIGH: if (vq) set_hi(&vq->avail, val); break;
+    case VIRTIO_MMIO_QUEUE_DEVICE_LOW:  if (vq) set_lo(&vq->used, val);  break;
+    case VIRTIO_MMIO_QUEUE_DEVICE_HIGH: if (vq) set_hi(&vq->used, val);  break;
+    default: break;
+  }
+}
+
+void virtio_mmio_access(VirtIODev *dev, uint32_t offset, int len, bool is_write) {
+  if (offset >= VIRTIO_MMIO_CONFIG) return; // the config space is accessed directly
+  Assert(len == 4 && offset % 4 == 0, "%s: unaligned register access at offset 0x%x", dev->name, offset);
+  uint32_t *reg = (uint32_t *)(dev->space + offset);
+  if (is_write) reg_write(dev, offset, *reg);
+  else *reg = reg_read(dev, offset);
+}
+
+bool virtq_pop(VirtIODev *dev, int q, VirtQElem *elem) {
+  VirtQueue *vq = &dev->vq[q];
+  if (!virtio_ready(dev, q) || vq->num == 0) return false;
+  uint16_t avail_idx = *(uint16_t *)vq_ptr(vq->avail + 2, 2);
+  if (vq->last_avail == avail_idx) return false;
+
+  uint16_t i = *(uint16_t *)vq_ptr(vq->avail + 4 + 2 * (vq->last_avail % vq->num), 2);
+  vq->last_avail ++;
+  elem->head = i;
+  elem->nr_seg = 0;
+  while (true) {
+    Assert(i < vq->num && (uint32_t)elem->nr_seg < vq->num, "%s: broken descriptor chain", dev->name);
+    VirtqDesc *d = (VirtqDesc *)vq_ptr(vq->desc + sizeof(VirtqDesc) * i, sizeof(VirtqDesc));
+    VirtIOSeg *s = &elem->seg[elem->nr_seg ++];
+    s->addr = d->addr;
+    s->len = d->len;
+    s->is_write = d->flags & VIRTQ_DESC_F_WRITE;
+    s->buf = (uint8_t *)vq_ptr(d->addr, d->len);
+    if (!(d->flags & VIRTQ_DESC_F_NEXT)) break;
+    i = d->next;
+  }
+  return true;
+}
+
+void virtq_push(VirtIODev *dev, int q, VirtQElem *elem, uint32_t len) {
+  VirtQueue *vq = &dev->vq[q];
+  uint16_t *used_idx = (uint16_t *)vq_ptr(vq->used + 2, 2);
+  uint64_t e = vq->used + 4 + 8 * (*used_idx % vq->num);
+  uint32_t *used_elem = (uint32_t *)vq_ptr(e, 8);
+  used_elem[0] = elem->head;
+  used_elem[1] = len;
+  (*used_idx) ++;
+
+#ifdef CONFIG_DIFFTEST
+  // the REF can not see the writes of the device, so bring them to it
+  int i;
+  for (i = 0; i < elem->nr_seg; i ++) {
+    VirtIOSeg *s = &elem->seg[i];
+    if (s->is_write && s->len > 0) ref_difftest_memcpy(s->addr, s->buf, s->len, DIFFTEST_TO_REF);
+  }
+  ref_difftest_memcpy(e, used_elem, 8, DIFFTEST_TO_REF);
+  ref_difftest_memcpy(vq->used + 2, used_idx, 2, DIFFTEST_TO_REF);
+#endif
+}
+
+void virtio_notify(VirtIODev *dev, int q) {
+  uint16_t flags = *(uint16_t *)vq_ptr(dev->vq[q].avail, 2);
+  if (flags & VIRTQ_AVAIL_F_NO_INTERRUPT) return;
+  dev->isr |= VIRTIO_INT_VRING;
+  update_irq(dev);
+}
+
+void virtio_init(VirtIODev *dev, paddr_t addr, io_callback_t callback) {
+  Assert(dev->nr_queue <= VIRTIO_MAX_QUEUE, "%s: too many queues", dev->name);
+  dev->features |= 1ull << VIRTIO_F_VERSION_1;
+  dev->space = new_space(VIRTIO_MMIO_SIZE);
+  memset(dev->space, 0, VIRTIO_MMIO_SIZE);
+  add_mmio_map(dev->name, addr, dev->space, VIRTIO_MMIO_SIZE, callback);
+  virtio_reset(dev);
+}
@@ -0,0 +1,90 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __VIRTIO_H__
+#define __VIRTIO_H__
+
+#include <common.h>
+#include <device/map.h>
+
+// virtio-mmio transport (version 2) with split virtqueues, see
+// https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html
+
+#define VIRTIO_MMIO_CONFIG 0x100
+#define VIRTIO_MMIO_SIZE   0x200
+
+#define VIRTIO_MAX_QUEUE 2
+#define VIRTQ_MAX_SIZE 256
+
+#define VIRTIO_F_VERSION_1 32
+
+enum { VIRTIO_ID_NET = 1, VIRTIO_ID_BLOCK = 2, VIRTIO_ID_CONSOLE = 3 };
+
+typedef struct {
+  uint8_t *buf;   // host address of the buffer
+  paddr_t addr;
+  uint32_t len;
+  bool is_write;  // the buffer is written by the device
+} VirtIOSeg;
+
+// a descriptor chain popped from the available ring
+typedef struct {
+  uint16_t head;
+  int nr_seg;
+  VirtIOSeg seg[VIRTQ_MAX_SIZE];
+} VirtQElem;
+
+typedef struct {
+  uint32_t num;
+  uint32_t ready;
+  uint64_t desc, avail, used;
+  uint16_t last_avail;
+} VirtQueue;
+
+typedef struct VirtIODev {
+  const char *name;
+  uint32_t device_id;
+  int irq;
+  uint64_t features;
+  uint64_t driver_features;
+  uint32_t status, isr, config_generation;
+  uint32_t dev_feat_sel, drv_feat_sel, queue_sel;
+  int nr_queue;
+  VirtQueue vq[VIRTIO_MAX_QUEUE];
+  uint8_t *space;
+  // called when the driver writes QueueNotify
+  void (*notify)(struct VirtIODev *dev, int q);
+  // called when the driver resets the device, can be NULL
+  void (*reset)(struct VirtIODev *dev);
+} VirtIODev;
+
+// `callback` should forward to virtio_mmio_access() with `dev`
+void virtio_init(VirtIODev *dev, paddr_t addr, io_callback_t callback);
+void virtio_mmio_access(VirtIODev *dev, uint32_t offset, int len, bool is_write);
+
+static inline uint8_t* virtio_config(VirtIODev *dev) {
+  return dev->space + VIRTIO_MMIO_CONFIG;
+}
+
+static inline bool virtio_ready(VirtIODev *dev, int q) {
+  return (dev->status & 0x4) && dev->vq[q].ready; // DRIVER_OK
+}
+
+bool virtq_pop(VirtIODev *dev, int q, VirtQElem *elem);
+void virtq_push(VirtIODev *dev, int q, VirtQElem *elem, uint32_t len);
+// raise the used buffer interrupt unless the driver suppresses it
+void virtio_notify(VirtIODev *dev, int q);
+
+#endif
@@ -20,6 +20,8 @@
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret) {
   difftest_skip_ref();
+  // the instructions before this one may fail to be compared with REF
+  if (nemu_state.state == NEMU_ABORT) return;
   nemu_state.state = state;
   nemu_state.halt_pc = pc;
   nemu_state.halt_ret = halt_ret;
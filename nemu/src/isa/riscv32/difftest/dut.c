@@ -16,8 +16,20 @@
 #include <isa.h>
 #include <cpu/difftest.h>
 #include "../local-include/reg.h"
+#include <stddef.h>
 
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
+  // REF only provides the first DIFFTEST_REG_SIZE bytes of the state
+  static_assert(offsetof(CPU_state, pc) + sizeof(cpu.pc) == DIFFTEST_REG_SIZE,
+      "the state from REF is not GPRs + pc");
+  if (likely(memcmp(ref_r, &cpu, DIFFTEST_REG_SIZE) == 0)) return true;
+
+  // find out the different ones
+  int i;
+  for (i = 0; i < ARRLEN(cpu.gpr); i ++) {
+    difftest_check_reg(reg_name(i), pc, ref_r->gpr[i], gpr(i));
+  }
+  difftest_check_reg("pc", pc, ref_r->pc, cpu.pc);
   return false;
 }
 
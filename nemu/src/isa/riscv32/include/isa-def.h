@@ -21,8 +21,22 @@
 typedef struct {
   word_t gpr[MUXDEF(CONFIG_RVE, 16, 32)];
   vaddr_t pc;
+  // machine-mode CSRs, placed after pc to keep the layout for difftest
+  struct {
+    word_t mstatus, mie, mip, mtvec, mscratch, mepc, mcause, mtval;
+  } csr;
 } MUXDEF(CONFIG_RV64, riscv64_CPU_state, riscv32_CPU_state);
 
+#define MSTATUS_MIE  (1 << 3)
+#define MSTATUS_MPIE (1 << 7)
+#define MSTATUS_MPP  (3 << 11)
+
+// bits in mip/mie, also the interrupt numbers in mcause
+enum { IRQ_MSI = 3, IRQ_MTI = 7, IRQ_MEI = 11 };
+#define MIP_MSIP (1 << IRQ_MSI)
+#define MIP_MTIP (1 << IRQ_MTI)
+#define MIP_MEIP (1 << IRQ_MEI)
+
 // decode
 typedef struct {
   union {
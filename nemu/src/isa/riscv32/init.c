@@ -32,6 +32,9 @@ static void restart() {
 
   /* The zero register is always 0. */
   cpu.gpr[0] = 0;
+
+  /* Start in M-mode, the same as the REF in difftest. */
+  cpu.csr.mstatus = MSTATUS_MPP;
 }
 
 void init_isa() {
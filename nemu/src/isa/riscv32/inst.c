@@ -21,6 +21,8 @@
 #define R(i) gpr(i)
 #define Mr vaddr_read
 #define Mw vaddr_write
+// the rs1 field of a CSR instruction, which is an immediate in csrrwi/csrrsi/csrrci
+#define UIMM BITS(s->isa.inst.val, 19, 15)
 
 enum {
   TYPE_I, TYPE_U, TYPE_S,
@@ -45,6 +47,32 @@ static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_
   }
 }
 
+// mip is driven by the interrupt controllers, and is read-only for software;
+// csrrs and csrrc only read the CSR if `wen` is false, i.e. rs1 (or uimm) is 0
+static void csr_rw(Decode *s, int rd, int idx, word_t val, int op, bool wen) {
+  word_t *p = csr_ptr(idx);
+  if (p == NULL) {
+    s->dnpc = isa_raise_intr(2, s->pc); // illegal instruction
+    cpu.csr.mtval = s->isa.inst.val;
+    return;
+  }
+  word_t old = *p;
+  switch (op) {
+    case 1: val = old | val; break;  // csrrs
+    case 2: val = old & ~val; break; // csrrc
+  }
+  if (wen && idx != 0x344) *p = val;
+  R(rd) = old;
+}
+
+static vaddr_t mret() {
+  word_t mstatus = cpu.csr.mstatus;
+  // MIE <- MPIE, MPIE <- 1
+  mstatus = (mstatus & ~MSTATUS_MIE) | ((mstatus & MSTATUS_MPIE) ? MSTATUS_MIE : 0);
+  cpu.csr.mstatus = mstatus | MSTATUS_MPIE;
+  return cpu.csr.mepc;
+}
+
 static int decode_exec(Decode *s) {
   int rd = 0;
   word_t src1 = 0, src2 = 0, imm = 0;
@@ -61,6 +89,16 @@ static int decode_exec(Decode *s) {
   INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(rd) = Mr(src1 + imm, 1));
   INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2));
 
+  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw  , I, csr_rw(s, rd, imm & 0xfff, src1, 0, true));
+  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs  , I, csr_rw(s, rd, imm & 0xfff, src1, 1, UIMM != 0));
+  INSTPAT("??????? ????? ????? 011 ????? 11100 11", csrrc  , I, csr_rw(s, rd, imm & 0xfff, src1, 2, UIMM != 0));
+  INSTPAT("??????? ????? ????? 101 ????? 11100 11", csrrwi , I, csr_rw(s, rd, imm & 0xfff, UIMM, 0, true));
+  INSTPAT("??????? ????? ????? 110 ????? 11100 11", csrrsi , I, csr_rw(s, rd, imm & 0xfff, UIMM, 1, UIMM != 0));
+  INSTPAT("??????? ????? ????? 111 ????? 11100 11", csrrci , I, csr_rw(s, rd, imm & 0xfff, UIMM, 2, UIMM != 0));
+  INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall  , N, s->dnpc = isa_raise_intr(11, s->pc)); // from M-mode
+  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret   , N, s->dnpc = mret());
+  INSTPAT("0001000 00101 00000 000 00000 11100 11", wfi    , N, ); // interrupts are checked after each instruction
+
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
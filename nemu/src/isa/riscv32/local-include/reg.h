@@ -16,7 +16,7 @@
 #ifndef __RISCV_REG_H__
 #define __RISCV_REG_H__
 
-#include <common.h>
+#include <isa.h>
 
 static inline int check_reg_idx(int idx) {
   IFDEF(CONFIG_RT_CHECK, assert(idx >= 0 && idx < MUXDEF(CONFIG_RVE, 16, 32)));
@@ -25,6 +25,21 @@ static inline int check_reg_idx(int idx) {
 
 #define gpr(idx) (cpu.gpr[check_reg_idx(idx)])
 
+// NULL for an unimplemented CSR
+static inline word_t* csr_ptr(int idx) {
+  switch (idx) {
+    case 0x300: return &cpu.csr.mstatus;
+    case 0x304: return &cpu.csr.mie;
+    case 0x305: return &cpu.csr.mtvec;
+    case 0x340: return &cpu.csr.mscratch;
+    case 0x341: return &cpu.csr.mepc;
+    case 0x342: return &cpu.csr.mcause;
+    case 0x343: return &cpu.csr.mtval;
+    case 0x344: return &cpu.csr.mip;
+    default: return NULL;
+  }
+}
+
 static inline const char* reg_name(int idx) {
   extern const char* regs[];
   return regs[check_reg_idx(idx)];
@@ -15,14 +15,30 @@
 
 #include <isa.h>
 
+#define INTR_BIT ((word_t)1 << (sizeof(word_t) * 8 - 1))
+
 word_t isa_raise_intr(word_t NO, vaddr_t epc) {
-  /* TODO: Trigger an interrupt/exception with ``NO''.
-   * Then return the address of the interrupt/exception vector.
-   */
+  cpu.csr.mcause = NO;
+  cpu.csr.mepc = epc;
+  // the only trap with a value is an illegal instruction, which sets it afterwards
+  cpu.csr.mtval = 0;
+  word_t mstatus = cpu.csr.mstatus;
+  // MPIE <- MIE, MIE <- 0, MPP <- M
+  mstatus = (mstatus & ~MSTATUS_MPIE) | ((mstatus & MSTATUS_MIE) ? MSTATUS_MPIE : 0);
+  mstatus = (mstatus & ~MSTATUS_MIE) | MSTATUS_MPP;
+  cpu.csr.mstatus = mstatus;
 
-  return 0;
+  word_t base = cpu.csr.mtvec & ~(word_t)3;
+  bool vectored = (cpu.csr.mtvec & 3) == 1;
+  return ((NO & INTR_BIT) && vectored ? base + 4 * (NO & ~INTR_BIT) : base);
 }
 
 word_t isa_query_intr() {
+  word_t pending = cpu.csr.mip & cpu.csr.mie;
+  if (likely(pending == 0) || !(cpu.csr.mstatus & MSTATUS_MIE)) return INTR_EMPTY;
+  // the priority defined by the privileged spec: MEI > MSI > MTI
+  if (pending & MIP_MEIP) return INTR_BIT | IRQ_MEI;
+  if (pending & MIP_MSIP) return INTR_BIT | IRQ_MSI;
+  if (pending & MIP_MTIP) return INTR_BIT | IRQ_MTI;
   return INTR_EMPTY;
 }
@@ -13,17 +13,31 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for memfd_create()
+#endif
 #include <memory/host.h>
 #include <memory/paddr.h>
 #include <device/mmio.h>
 #include <isa.h>
+#include <cpu/difftest.h>
 
 #if   defined(CONFIG_PMEM_MALLOC)
 static uint8_t *pmem = NULL;
 #else // CONFIG_PMEM_GARRAY
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
 static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 #endif
 
+// With NEMU as REF, pmem is backed by a memfd until REF maps it. Then both
+// map the memfd privately, so that the image is shared copy-on-write.
+#if defined(CONFIG_DIFFTEST_REF_NEMU) && defined(CONFIG_PMEM_GARRAY)
+#define PMEM_SHARE 1
+static int pmem_fd = -1;
+#endif
+
 uint8_t* guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
 paddr_t host_to_guest(uint8_t *haddr) { return haddr - pmem + CONFIG_MBASE; }
 
@@ -41,10 +55,41 @@ static void out_of_bound(paddr_t addr) {
       addr, PMEM_LEFT, PMEM_RIGHT, cpu.pc);
 }
 
+#ifdef CONFIG_PMEM_GARRAY
+static void pmem_map(int fd, int flags) {
+  void *p = mmap(pmem, CONFIG_MSIZE, PROT_READ | PROT_WRITE, flags | MAP_FIXED, fd, 0);
+  Assert(p == pmem, "Can not map pmem: %s", strerror(errno));
+}
+
+// the content of `fd` becomes pmem, and the writes after this do not reach `fd`
+void pmem_map_private(int fd) {
+  pmem_map(fd, MAP_PRIVATE);
+}
+#endif
+
+// `share` maps the memfd of pmem, and then the memfd is no longer needed
+bool pmem_share(void (*share)(paddr_t addr, int fd, size_t n)) {
+#ifdef PMEM_SHARE
+  if (pmem_fd >= 0) {
+    share(CONFIG_MBASE, pmem_fd, CONFIG_MSIZE);
+    pmem_map_private(pmem_fd);
+    close(pmem_fd);
+    pmem_fd = -1;
+    return true;
+  }
+#endif
+  return false;
+}
+
 void init_mem() {
 #if   defined(CONFIG_PMEM_MALLOC)
   pmem = malloc(CONFIG_MSIZE);
   assert(pmem);
+#endif
+#ifdef PMEM_SHARE
+  pmem_fd = memfd_create("nemu-pmem", MFD_CLOEXEC);
+  Assert(pmem_fd >= 0 && ftruncate(pmem_fd, CONFIG_MSIZE) == 0, "Can not create memfd for pmem");
+  pmem_map(pmem_fd, MAP_SHARED);
 #endif
   IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE));
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
@@ -58,7 +103,14 @@ word_t paddr_read(paddr_t addr, int len) {
 }
 
 void paddr_write(paddr_t addr, int len, word_t data) {
-  if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
+  if (likely(in_pmem(addr))) {
+#if CONFIG_DIFFTEST_WINDOW > 1 || defined(CONFIG_DIFFTEST_MEMCHECK)
+    difftest_log_store(addr, len);
+#endif
+    IFDEF(CONFIG_COMMIT_LOG, commit_log_store(addr, len, data));
+    pmem_write(addr, len, data);
+    return;
+  }
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
   out_of_bound(addr);
 }
@@ -20,6 +20,7 @@ void init_rand();
 void init_log(const char *log_file);
 void init_mem();
 void init_difftest(char *ref_so_file, long img_size, int port);
+void init_commit_log(const char *record_file, const char *verify_file);
 void init_device();
 void init_sdb();
 void init_disasm(const char *triple);
@@ -38,11 +39,16 @@ static void welcome() {
 #include <getopt.h>
 
 void sdb_set_batch_mode();
+void add_plugin(const char *spec);
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
 static int difftest_port = 1234;
+#ifdef CONFIG_COMMIT_LOG
+static char *record_file = NULL;
+static char *verify_file = NULL;
+#endif
 
 static long load_img() {
   if (img_file == NULL) {
@@ -72,6 +78,9 @@ static int parse_args(int argc, char *argv[]) {
     {"log"      , required_argument, NULL, 'l'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
+    {"plugin"   , required_argument, NULL, 'P'},
+    {"record"   , required_argument, NULL, 'R'},
+    {"verify"   , required_argument, NULL, 'V'},
     {"help"     , no_argument      , NULL, 'h'},
     {0          , 0                , NULL,  0 },
   };
@@ -82,6 +91,15 @@ static int parse_args(int argc, char *argv[]) {
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
+      case 'P':
+        IFDEF(CONFIG_PLUGIN, add_plugin(optarg); break);
+        panic("Device plugins are not enabled");
+      case 'R':
+        IFDEF(CONFIG_COMMIT_LOG, record_file = optarg; break);
+        panic("Commit logs are not enabled");
+      case 'V':
+        IFDEF(CONFIG_COMMIT_LOG, verify_file = optarg; break);
+        panic("Commit logs are not enabled");
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
@@ -89,6 +107,9 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t--plugin=SO[,ARGS]      load the device plugin SO with ARGS\n");
+        printf("\t--record=FILE           record the execution to the commit log FILE\n");
+        printf("\t--verify=FILE           compare the execution with the commit log FILE\n");
         printf("\n");
         exit(0);
     }
@@ -120,8 +141,11 @@ void init_monitor(int argc, char *argv[]) {
   /* Load the image to memory. This will overwrite the built-in image. */
   long img_size = load_img();
 
-  /* Initialize differential testing. */
-  init_difftest(diff_so_file, img_size, difftest_port);
+  /* Initialize differential testing, which is replaced by the commit log when verifying. */
+  if (MUXDEF(CONFIG_COMMIT_LOG, verify_file == NULL, true)) init_difftest(diff_so_file, img_size, difftest_port);
+
+  /* Record or verify the commit log. */
+  IFDEF(CONFIG_COMMIT_LOG, init_commit_log(record_file, verify_file));
 
   /* Initialize the simple debugger. */
   init_sdb();
@@ -20,10 +20,18 @@
 
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <linux/kvm.h>
 
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
 /* CR0 bits */
 #define CR0_PE 1u
 #define CR0_PG (1u << 31)
@@ -35,6 +43,12 @@
 #define RFLAGS_AF  (1u << 4)
 #define RFLAGS_FIX_MASK (RFLAGS_ID | RFLAGS_AC | RFLAGS_RF | RFLAGS_TF | RFLAGS_AF)
 
+// a block costs three ioctls, so it only pays off for longer runs
+#define RUN_TO_MIN 4
+#define RUN_TO_MAX_BYTES 4096
+// give up running to a breakpoint after this time, since REF has diverged
+#define RUN_TIMEOUT_MS 1000
+
 struct vm {
   int sys_fd;
   int fd;
@@ -327,6 +341,104 @@ static void kvm_exec(uint64_t n) {
   }
 }
 
+// Return true if [start, end) may contain instructions which are patched
+// when single-stepping (see patching() and patching_after()), or which
+// enter an interrupt handler. Other instructions may contain such bytes,
+// and then the block is also single-stepped.
+static bool need_stepping(uint32_t start, uint32_t end) {
+  uint32_t i;
+  for (i = start; i < end; i ++) {
+    switch (vm.mem[i]) {
+      case 0x9c: case 0x9d: case 0xcf:  // pushf, popf, iret
+      case 0x1e: case 0x06:             // push %ds, push %es
+      case 0xcc: case 0xcd: case 0xce:  // int3, int, into
+        return true;
+      case 0x0f: if (i + 1 < end && vm.mem[i + 1] == 0xa0) return true; break; // push %fs
+    }
+  }
+  return false;
+}
+
+static timer_t run_timer;
+static bool run_timer_ready = false;
+static volatile bool run_timeout = false;
+
+static void run_timeout_handler(int sig) {
+  run_timeout = true;
+}
+
+static void init_run_timer() {
+  struct sigaction sa = {};
+  sa.sa_handler = run_timeout_handler;
+  // no SA_RESTART, so that KVM_RUN is interrupted
+  sigaction(SIGALRM, &sa, NULL);
+  // the signal goes to the thread running REF, which is not the thread
+  // calling difftest_init() with CONFIG_DIFFTEST_PIPELINE
+  struct sigevent sev = {};
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = SIGALRM;
+  sev.sigev_notify_thread_id = syscall(SYS_gettid);
+  int ret = timer_create(CLOCK_MONOTONIC, &sev, &run_timer);
+  assert(ret == 0);
+  run_timer_ready = true;
+}
+
+// Run to the hardware breakpoint at `pc` without single-stepping, and
+// return false if the block should be single-stepped.
+static bool kvm_run_to(uint32_t pc) {
+  struct kvm_regs *regs = &vcpu.kvm_run->s.regs.regs;
+  uint32_t rip = regs->rip;
+  // the watchpoint for an interrupt is in use
+  if (vcpu.int_wp_state != STATE_IDLE) return false;
+  if (pc <= rip || pc - rip > RUN_TO_MAX_BYTES) return false;
+  // the block is in at most two pages, which should be contiguous
+  uint64_t start = va2pa(rip), last = va2pa(pc - 1);
+  if (start >= CONFIG_MSIZE || last >= CONFIG_MSIZE || last - start != pc - 1 - rip) return false;
+  if (need_stepping(start, last + 1)) return false;
+
+  struct kvm_guest_debug debug = {};
+  debug.control = KVM_GUESTDBG_ENABLE | KVM_GUESTDBG_USE_HW_BP;
+  debug.arch.debugreg[0] = pc;
+  debug.arch.debugreg[7] = 0x1; // break on instruction fetch at `pc`
+  if (ioctl(vcpu.fd, KVM_SET_GUEST_DEBUG, &debug) < 0) {
+    perror("KVM_SET_GUEST_DEBUG");
+    assert(0);
+  }
+  // TF should not raise #DB in the guest
+  bool tf = (regs->rflags & RFLAGS_TF) != 0;
+  regs->rflags &= ~RFLAGS_TF;
+  vcpu.kvm_run->kvm_dirty_regs = KVM_SYNC_X86_REGS;
+
+  struct itimerspec timeout = { .it_value = { .tv_sec = RUN_TIMEOUT_MS / 1000,
+    .tv_nsec = (RUN_TIMEOUT_MS % 1000) * 1000000 } };
+  struct itimerspec disarm = {};
+  if (!run_timer_ready) init_run_timer();
+  run_timeout = false;
+  timer_settime(run_timer, 0, &timeout, NULL);
+  int ret;
+  while ((ret = ioctl(vcpu.fd, KVM_RUN, 0)) < 0 && errno == EINTR && !run_timeout) ;
+  timer_settime(run_timer, 0, &disarm, NULL);
+  if (ret < 0 && errno != EINTR) {
+    perror("KVM_RUN");
+    assert(0);
+  }
+  if (ret < 0) {
+    // the difference will be found in the registers
+    printf("KVM does not reach pc = 0x%x in %d ms\n", pc, RUN_TIMEOUT_MS);
+  } else if (vcpu.kvm_run->exit_reason != KVM_EXIT_DEBUG && vcpu.kvm_run->exit_reason != KVM_EXIT_HLT) {
+    fprintf(stderr, "Got exit_reason %d at pc = 0x%llx, expected KVM_EXIT_DEBUG (%d)\n",
+        vcpu.kvm_run->exit_reason, regs->rip, KVM_EXIT_DEBUG);
+    assert(0);
+  }
+
+  if (tf) {
+    regs->rflags |= RFLAGS_TF;
+    vcpu.kvm_run->kvm_dirty_regs = KVM_SYNC_X86_REGS;
+  }
+  kvm_set_step_mode(false, 0);
+  return true;
+}
+
 static void run_protected_mode() {
   struct kvm_sregs sregs;
   kvm_getsregs(&sregs);
@@ -382,6 +494,13 @@ __EXPORT void difftest_exec(uint64_t n) {
   kvm_exec(n);
 }
 
+// Execute `n` instructions, whose pcs are increasing and end at `pc`. This
+// is guaranteed by the DUT, so the block only contains the bytes between
+// the current pc and `pc`.
+__EXPORT void difftest_exec_block(uint64_t n, uint64_t pc) {
+  if (n < RUN_TO_MIN || !kvm_run_to(pc)) kvm_exec(n);
+}
+
 __EXPORT void difftest_raise_intr(word_t NO) {
   uint32_t pgate_vaddr = vcpu.kvm_run->s.regs.sregs.idt.base + NO * 8;
   uint32_t pgate = va2pa(pgate_vaddr);
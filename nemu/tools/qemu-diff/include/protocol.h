@@ -35,3 +35,9 @@ void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size);
 uint8_t *gdb_recv(struct gdb_conn *conn, size_t *size);
 
 const char * gdb_start_noack(struct gdb_conn *conn);
+
+// wait for a reply, return false on timeout
+bool gdb_wait(struct gdb_conn *conn, int timeout_ms);
+
+// stop the target while it is running
+void gdb_interrupt(struct gdb_conn *conn);
@@ -22,9 +22,20 @@ bool gdb_connect_qemu(int);
 bool gdb_memcpy_to_qemu(uint32_t, void *, int);
 bool gdb_getregs(union isa_gdb_regs *);
 bool gdb_setregs(union isa_gdb_regs *);
+bool gdb_setregs_mask(const void *regs, int size, uint64_t mask);
 bool gdb_si();
+bool gdb_run_to(uint32_t pc);
 void gdb_exit();
 
+#define REG_SIZE MUXDEF(CONFIG_ISA64, 8, 4)
+
+// a breakpoint costs three round-trips, so it only pays off for longer runs
+#define RUN_TO_MIN 4
+
+static union isa_gdb_regs qemu_r;
+// the registers are only read again after QEMU executes
+static bool qemu_r_valid = false;
+
 void init_isa();
 
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
@@ -36,8 +47,10 @@ __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction)
 }
 
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
-  union isa_gdb_regs qemu_r;
-  gdb_getregs(&qemu_r);
+  if (!qemu_r_valid) {
+    gdb_getregs(&qemu_r);
+    qemu_r_valid = true;
+  }
   if (direction == DIFFTEST_TO_REF) {
     memcpy(&qemu_r, dut, DIFFTEST_REG_SIZE);
     gdb_setregs(&qemu_r);
@@ -46,10 +59,35 @@ __EXPORT void difftest_regcpy(void *dut, bool direction) {
   }
 }
 
+// only write the registers selected by `mask`, which are usually a few
+__EXPORT void difftest_regcpy_mask(void *dut, uint64_t mask) {
+  static bool p_packet = true;
+  if (p_packet) p_packet = gdb_setregs_mask(dut, REG_SIZE, mask);
+  if (!p_packet && !qemu_r_valid) {
+    gdb_getregs(&qemu_r);
+    qemu_r_valid = true;
+  }
+  if (qemu_r_valid) {
+    int i;
+    for (i = 0; i < 64; i ++) {
+      if (mask & (1ull << i)) memcpy((uint8_t *)&qemu_r + i * REG_SIZE, (uint8_t *)dut + i * REG_SIZE, REG_SIZE);
+    }
+  }
+  if (!p_packet) gdb_setregs(&qemu_r);
+}
+
 __EXPORT void difftest_exec(uint64_t n) {
+  qemu_r_valid = false;
   while (n --) gdb_si();
 }
 
+// Execute `n` instructions, where `pc` is reached for the first time
+// after the last one. This is guaranteed by the DUT.
+__EXPORT void difftest_exec_until(uint64_t n, uint64_t pc) {
+  qemu_r_valid = false;
+  if (n < RUN_TO_MIN || !gdb_run_to(pc)) difftest_exec(n);
+}
+
 __EXPORT void difftest_init(int port) {
   char buf[32];
   sprintf(buf, "tcp::%d", port);
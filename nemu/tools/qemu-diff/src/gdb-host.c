@@ -15,27 +15,68 @@
 
 #include "common.h"
 
+// give up running to a breakpoint after this time, since REF has diverged
+#define RUN_TIMEOUT_MS 1000
+
 static struct gdb_conn *conn;
+static bool binary_mem = true;
 
 bool gdb_connect_qemu(int port) {
   // connect to gdbserver on localhost port 1234
   while ((conn = gdb_begin_inet("127.0.0.1", port)) == NULL) {
     usleep(1);
   }
+  // no '+' for each packet
+  gdb_start_noack(conn);
 
   return true;
 }
 
+static bool recv_ok() {
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  bool ok = !strcmp((const char*)reply, "OK");
+  free(reply);
+  return ok;
+}
+
+// a run ends with one stop reply, and other packets (e.g. the console
+// output of 'O') may come before it
+static bool is_stop_reply(const uint8_t *reply) {
+  return reply[0] == 'S' || reply[0] == 'T' || reply[0] == 'W' || reply[0] == 'X';
+}
+
+static void recv_stop() {
+  size_t size;
+  uint8_t *reply;
+  while (!is_stop_reply(reply = gdb_recv(conn, &size))) free(reply);
+  free(reply);
+}
+
 static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
   char *buf = malloc(len * 2 + 128);
   assert(buf != NULL);
-  int p = sprintf(buf, "M0x%x,%x:", dest, len);
-  int i;
-  for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
+  uint8_t *data = src;
+  int p, i;
+  if (binary_mem) {
+    // binary data with escaped special characters
+    p = sprintf(buf, "X%x,%x:", dest, len);
+    for (i = 0; i < len; i ++) {
+      uint8_t c = data[i];
+      if (c == '$' || c == '#' || c == '}' || c == '*') {
+        buf[p ++] = '}';
+        c ^= 0x20;
+      }
+      buf[p ++] = c;
+    }
+  } else {
+    p = sprintf(buf, "M0x%x,%x:", dest, len);
+    for (i = 0; i < len; i ++) {
+      p += sprintf(buf + p, "%c%c", hex_encode(data[i] >> 4), hex_encode(data[i] & 0xf));
+    }
   }
 
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  gdb_send(conn, (const uint8_t *)buf, p);
   free(buf);
 
   size_t size;
@@ -43,6 +84,11 @@ static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
   bool ok = !strcmp((const char*)reply, "OK");
   free(reply);
 
+  if (binary_mem && size == 0) {
+    // X packets are not supported
+    binary_mem = false;
+    return gdb_memcpy_to_qemu_small(dest, src, len);
+  }
   return ok;
 }
 
@@ -96,11 +142,28 @@ bool gdb_setregs(union isa_gdb_regs *r) {
   gdb_send(conn, (const uint8_t *)buf, strlen(buf));
   free(buf);
 
-  size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
-  bool ok = !strcmp((const char*)reply, "OK");
-  free(reply);
+  return recv_ok();
+}
 
+// Write the registers of `size` bytes selected by `mask`, with a P packet
+// for each. All the packets are sent before waiting for the replies.
+// Return false if P packets are not supported.
+bool gdb_setregs_mask(const void *regs, int size, uint64_t mask) {
+  const uint8_t *src = regs;
+  int i, j, nr = 0;
+  for (i = 0; i < 64; i ++) {
+    if (!(mask & (1ull << i))) continue;
+    char buf[64];
+    int p = sprintf(buf, "P%x=", i);
+    for (j = 0; j < size; j ++) {
+      uint8_t c = src[i * size + j];
+      p += sprintf(buf + p, "%c%c", hex_encode(c >> 4), hex_encode(c & 0xf));
+    }
+    gdb_send(conn, (const uint8_t *)buf, p);
+    nr ++;
+  }
+  bool ok = true;
+  while (nr -- > 0) ok &= recv_ok();
   return ok;
 }
 
@@ -113,6 +176,38 @@ bool gdb_si() {
   return true;
 }
 
+// Continue until `pc` is reached, return false if breakpoints are not supported.
+bool gdb_run_to(uint32_t pc) {
+  char buf[32];
+  sprintf(buf, "Z0,%x,4", pc);
+  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  if (!recv_ok()) return false;
+
+  strcpy(buf, "vCont;c");
+  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  if (!gdb_wait(conn, RUN_TIMEOUT_MS)) {
+    // stop QEMU, and the difference will be found in the registers
+    printf("QEMU does not reach pc = 0x%x in %d ms\n", pc, RUN_TIMEOUT_MS);
+    gdb_interrupt(conn);
+  }
+  recv_stop();
+
+  sprintf(buf, "z0,%x,4", pc);
+  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  // QEMU may reach the breakpoint while being interrupted, and then the
+  // stop reply of the interrupt comes before the reply of z0
+  size_t size;
+  uint8_t *reply;
+  while (is_stop_reply(reply = gdb_recv(conn, &size))) free(reply);
+  bool ok = !strcmp((const char *)reply, "OK");
+  free(reply);
+  if (!ok) {
+    printf("Can not remove the breakpoint at pc = 0x%x\n", pc);
+    assert(0);
+  }
+  return true;
+}
+
 void gdb_exit() {
   gdb_end(conn);
 }
@@ -20,6 +20,7 @@
 #include "common.h"
 #include <ctype.h>
 #include <err.h>
+#include <fcntl.h>
 
 #include <arpa/inet.h>
 
@@ -28,6 +29,7 @@
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <poll.h>
 
 struct gdb_conn {
   FILE *in;
@@ -303,3 +305,26 @@ const char* gdb_start_noack(struct gdb_conn *conn) {
     conn->ack = false;
   return ok ? "OK" : "";
 }
+
+bool gdb_wait(struct gdb_conn *conn, int timeout_ms) {
+  // the reply may be in the buffer of the FILE already, if it is read
+  // together with the previous one, so peek at it without blocking first
+  int fd = fileno(conn->in);
+  int flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  int c = fgetc(conn->in);
+  fcntl(fd, F_SETFL, flags);
+  if (c != EOF) {
+    ungetc(c, conn->in);
+    return true;
+  }
+  clearerr(conn->in);
+
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+void gdb_interrupt(struct gdb_conn *conn) {
+  fputc(0x03, conn->out);
+  fflush(conn->out);
+}
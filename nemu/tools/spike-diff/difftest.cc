@@ -70,20 +70,38 @@ void sim_t::diff_set_regs(void* diff_context) {
   state->pc = ctx->pc;
 }
 
-void sim_t::diff_memcpy(reg_t dest, void* src, size_t n) {
-  mmu_t* mmu = p->get_mmu();
-  for (size_t i = 0; i < n; i++) {
-    mmu->store<uint8_t>(dest+i, *((uint8_t*)src+i));
+// Copy between `buf` and the backing pages of the memory directly, one
+// page at a time, instead of going through the MMU byte by byte.
+static void mem_copy(reg_t addr, void* buf, size_t n, bool to_ref) {
+  reg_t base = difftest_mem[0].first;
+  mem_t* mem = difftest_mem[0].second;
+  assert(addr >= base && addr - base + n <= mem->size());
+  reg_t off = addr - base;
+  uint8_t* data = (uint8_t*)buf;
+  while (n > 0) {
+    size_t len = std::min<size_t>(n, PGSIZE - off % PGSIZE);
+    char* host = mem->contents(off);
+    if (to_ref) memcpy(host, data, len);
+    else memcpy(data, host, len);
+    off += len;
+    data += len;
+    n -= len;
   }
 }
 
+void sim_t::diff_memcpy(reg_t dest, void* src, size_t n) {
+  mem_copy(dest, src, n, true);
+  // the code may be changed
+  p->get_mmu()->flush_icache();
+}
+
 extern "C" {
 
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
   if (direction == DIFFTEST_TO_REF) {
     s->diff_memcpy(addr, buf, n);
   } else {
-    assert(0);
+    mem_copy(addr, buf, n, false);
   }
 }
 